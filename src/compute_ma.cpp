@@ -29,6 +29,7 @@ SOFTWARE.
 #include "compute_ma_processing.h"
 #include "io.h"
 #include "madata.h"
+#include "morton.h"
 #include "types.h"
 
 int main(int argc, char **argv) {
@@ -36,14 +37,41 @@ int main(int argc, char **argv) {
    try {
       TCLAP::CmdLine cmd("Computes a MAT point approximation, see also https://github.com/tudelft3d/masbcpp", ' ', "0.1");
 
-      TCLAP::UnlabeledValueArg<std::string> inputArg("input", "path to directory with inside it a 'coords.npy' and a 'normals.npy' file. Both should be Nx3 float arrays where N is the number of input points.", true, "", "input dir", cmd);
+      TCLAP::UnlabeledValueArg<std::string> inputArg("input", "path to directory with inside it a 'coords.npy' and a 'normals.npy' file. Both should be Nx3 float arrays where N is the number of input points, or the normals a 1D uint16 or uint32 array in octahedral encoding.", true, "", "input dir", cmd);
       TCLAP::UnlabeledValueArg<std::string> outputArg("output", "path to output directory", false, "", "output dir", cmd);
 
       TCLAP::ValueArg<double> denoise_preserveArg("d", "preserve", "denoise preserve threshold", false, 20, "double", cmd);
       TCLAP::ValueArg<double> denoise_planarArg("p", "planar", "denoise planar threshold", false, 32, "double", cmd);
       TCLAP::ValueArg<double> initial_radiusArg("r", "radius", "initial ball radius", false, 200, "double", cmd);
 
+      std::vector<std::string> engines;
+      engines.push_back("shrink");
+      engines.push_back("minradius");
+      engines.push_back("wavefront");
+      TCLAP::ValuesConstraint<std::string> enginesConstraint(engines);
+      TCLAP::ValueArg<std::string> engineArg("e", "engine", "algorithm used to find the medial balls: 'shrink' runs the shrinking ball iterations, 'minradius' finds the final ball with a single search, 'wavefront' runs the shrinking ball iterations for all points in lockstep, which scales better on many cores", false, "shrink", &enginesConstraint, cmd);
+
+      std::vector<std::string> sides;
+      sides.push_back("inner");
+      sides.push_back("outer");
+      sides.push_back("both");
+      TCLAP::ValuesConstraint<std::string> sidesConstraint(sides);
+      TCLAP::ValueArg<std::string> sidesArg("s", "sides", "compute the interior balls, the exterior balls or both. Results are written to the '_in' and '_out' files respectively", false, "inner", &sidesConstraint, cmd);
+
       TCLAP::SwitchArg nan_for_initrSwitch("a", "nan", "write nan for points with radius equal to initial radius", cmd, false);
+      TCLAP::SwitchArg mortonSwitch("z", "morton", "sort the points in Morton (Z-order) before processing so that nearby points are processed together, which is faster for large point clouds. The outputs keep the input order", cmd, false);
+      TCLAP::SwitchArg kdtreeCacheSwitch("", "kdtree_cache", "read the kd-tree over the points from a file in the input directory that an earlier run with the same points and -z setting wrote, or build it and write that file. Saves the tree construction when the same points are processed again", cmd, false);
+      TCLAP::ValueArg<std::string> lasArg("", "las", "read the points from this LAS file instead of 'coords.npy', relative to the center of their bounding box (written to 'origin.npy'). The normals are still read from the input directory", false, "", "las file", cmd);
+      TCLAP::ValueArg<std::string> plyArg("", "ply", "read the points and normals from the vertices of this binary PLY file instead of the input directory", false, "", "ply file", cmd);
+      TCLAP::ValueArg<std::string> plyOutArg("", "ply_out", "also write the points, normals and medial balls as vertices of this binary PLY file", false, "", "ply file", cmd);
+      TCLAP::ValueArg<std::string> npzArg("", "npz", "write the ma_coords, ma_qidx and ma_radius arrays into this zip compressed .npz archive instead of separate .npy files in the output directory", false, "", "npz file", cmd);
+      std::vector<int> normal_bits;
+      normal_bits.push_back(16);
+      normal_bits.push_back(32);
+      TCLAP::ValuesConstraint<int> normalBitsConstraint(normal_bits);
+      TCLAP::ValueArg<int> octNormalsArg("", "oct_normals", "keep the normals in octahedral encoding of 16 or 32 bits instead of 3 floats, which takes much less memory for large clouds. Normals that are stored in that encoding already (see compute_normals) are always kept that way", false, 32, &normalBitsConstraint, cmd);
+      TCLAP::SwitchArg radiusOnlySwitch("", "radius_only", "write only the ma_qidx and ma_radius arrays, without ma_coords, which takes about a third of the space. Readers such as simplify rebuild the centers from the points, the normals in the input directory and the radii", cmd, false);
+      TCLAP::SwitchArg warm_startSwitch("w", "warm", "start each ball from the radius of a nearby ball that was already computed instead of the initial radius. Falls back to the initial radius when that ball is empty", cmd, false);
 
       cmd.parse(argc, argv);
 
@@ -53,31 +81,53 @@ int main(int argc, char **argv) {
       input_parameters.denoise_preserve = (M_PI / 180.0) * denoise_preserveArg.getValue();
       input_parameters.denoise_planar = (M_PI / 180.0) * denoise_planarArg.getValue();
       input_parameters.nan_for_initr = nan_for_initrSwitch.getValue();
+      input_parameters.warm_start = warm_startSwitch.getValue();
+      input_parameters.sides = sidesArg.getValue() == "both" ? MA_BOTH : sidesArg.getValue() == "outer" ? MA_OUTER : MA_INNER;
+      input_parameters.engine = engineArg.getValue() == "minradius" ? MA_ENGINE_MINRADIUS : engineArg.getValue() == "wavefront" ? MA_ENGINE_WAVEFRONT : MA_ENGINE_SHRINK;
 
       std::string output_path = outputArg.isSet() ? outputArg.getValue() : inputArg.getValue();
 
-      std::cout << "Parameters: denoise_preserve=" << denoise_preserveArg.getValue() << ", denoise_planar=" << denoise_planarArg.getValue() << ", initial_radius=" << input_parameters.initial_radius << "\n";
+      std::cout << "Parameters: denoise_preserve=" << denoise_preserveArg.getValue() << ", denoise_planar=" << denoise_planarArg.getValue() << ", initial_radius=" << input_parameters.initial_radius << ", engine=" << engineArg.getValue() << ", sides=" << sidesArg.getValue() << "\n";
 
       io_parameters io_params = {};
       io_params.coords = true;
       io_params.normals = true;
+      io_params.normal_bits = octNormalsArg.isSet() ? octNormalsArg.getValue() : 0;
 
       ma_data madata = {};
-      npy2madata(inputArg.getValue(), madata, io_params);
+      if (lasArg.isSet()) {
+         las2madata(lasArg.getValue(), madata);
+         io_params.coords = false;
+      }
+      if (plyArg.isSet())
+         ply2madata(plyArg.getValue(), madata, io_params);
+      else
+         npy2madata(inputArg.getValue(), madata, io_params);
+
+      if (mortonSwitch.getValue())
+         morton_sort(madata);
+      if (kdtreeCacheSwitch.getValue())
+         attach_kdtree(inputArg.getValue(), madata);
 
       // Perform the actual processing
-      madata.ma_coords.reset(new PointCloud);
-      madata.ma_coords->resize(2 * madata.coords->size());
-      madata.ma_qidx.resize(2 * madata.coords->size());
-	  madata.ma_radius.resize(2 * madata.coords->size());
       compute_masb_points(input_parameters, madata);
+      restore_order(madata);
 
       io_params.coords = false;
       io_params.normals = false;
-      io_params.ma_coords = true;
+      io_params.ma_coords = !radiusOnlySwitch.getValue();
       io_params.ma_qidx = true;
 	  io_params.ma_radius = true;
-      madata2npy(output_path, madata, io_params);
+      if (npzArg.isSet())
+         madata2npz(npzArg.getValue(), madata, io_params);
+      else
+         madata2npy(output_path, madata, io_params);
+      if (plyOutArg.isSet()) {
+         io_params.coords = true;
+         io_params.normals = true;
+         io_params.ma_coords = true;
+         madata2ply(plyOutArg.getValue(), madata, io_params);
+      }
 
       {
          std::string output_path_metadata = output_path + "/compute_ma";
@@ -92,7 +142,13 @@ int main(int argc, char **argv) {
             << "initial_radius " << input_parameters.initial_radius << std::endl
             << "nan_for_initr " << input_parameters.nan_for_initr << std::endl
             << "denoise_preserve " << denoise_preserveArg.getValue() << std::endl
-            << "denoise_planar " << denoise_planarArg.getValue() << std::endl;
+            << "denoise_planar " << denoise_planarArg.getValue() << std::endl
+            << "engine " << engineArg.getValue() << std::endl
+            << "warm_start " << input_parameters.warm_start << std::endl
+            << "sides " << sidesArg.getValue() << std::endl
+            << "radius_only " << radiusOnlySwitch.getValue() << std::endl
+            // the normals that the centers lie on, readers rebuild them with the same encoding
+            << "oct_normals " << madata.packed_normals.bits << std::endl;
          metadata.close();
       }
    }
@@ -21,7 +21,11 @@ SOFTWARE.
 */
 
 #include "compute_ma_processing.h"
+#include "morton.h"
+#include "sb_kernels.h"
 
+#include <algorithm>
+#include <iterator>
 #include <limits>
 
 #ifdef VERBOSEPRINT
@@ -43,6 +47,13 @@ typedef std::chrono::high_resolution_clock Clock;
 
 const Scalar delta_convergance = 1E-5f;
 const unsigned int iteration_limit = 30;
+// Margin on the radius of the previous ball when it is used as the start radius of the next
+const Scalar warm_start_factor = 2;
+// Largest number of points in a ball for which sb_point switches from the kd-tree to a plain list
+const size_t candidate_limit = 256;
+// Number of nearest neighbour queries the wavefront engine hands to the kd-tree at once
+const size_t query_batch = 64;
+static_assert(query_batch <= sb_batch::capacity, "a query batch has to fit in one sb_batch");
 const Point nanPoint(std::numeric_limits<Scalar>::quiet_NaN(), std::numeric_limits<Scalar>::quiet_NaN(), std::numeric_limits<Scalar>::quiet_NaN());
 
 inline Scalar compute_radius(const Vector3 &p, const Vector3 &n, const Vector3 &q) {
@@ -60,99 +71,198 @@ inline Scalar cos_angle(const Vector3 p, const Vector3 q) {
    return result;
 }
 
-ma_result sb_point(const ma_parameters &input_parameters, const Vector3 &p, const Vector3 &n, pcl::search::KdTree<Point>::Ptr kd_tree) {
+inline Scalar candidate_margin(const Vector3 &c, Scalar r) {
+   // Slack on the ball radius that covers rounding errors in the ball centers
+   return delta_convergance + 4 * std::numeric_limits<Scalar>::epsilon() * (c.cwiseAbs().maxCoeff() + r);
+}
+
+inline bool denoise_reject(const denoise_thresholds &denoise, const Vector3 &p, const Vector3 &q, const Vector3 &c, Scalar r, unsigned int j) {
+   // Whether the ball with center c and radius r that touches p and q should be rejected as noise.
+   // The first ball (j == 0) is tested with the planar threshold, the following ones with the preserve threshold.
+   // A separation angle below the threshold is a cosine above the cosine of the threshold.
+   if (!denoise.planar && !denoise.preserve)
+      return false;
+   Scalar a = cos_angle(p - c, q - c);
+
+   if (j == 0 && denoise.planar && a > denoise.cos_planar)
+      return true;
+   if (j > 0 && denoise.preserve && (a > denoise.cos_preserve && r > (q - p).norm()))
+      return true;
+   return false;
+}
+
+ma_result sb_point(const ma_parameters &input_parameters, const denoise_thresholds &denoise, const Vector3 &p, const Vector3 &n, const flat_kdtree &kd_tree, flat_kdtree::point_list &candidates, Scalar start_radius = 0) {
    // Calculate a medial ball for a given oriented point using the shrinking ball algorithm,
    // see https://3d.bk.tudelft.nl/rypeters/pdfs/16candg.pdf section 3.2 for details
+   // A start_radius below the initial radius is only a guess. If that ball is empty, or the first
+   // ball is rejected, we start over from the initial radius.
+   bool guessed = start_radius > 0 && start_radius < input_parameters.initial_radius;
    unsigned int j = 0;
-   Scalar r = input_parameters.initial_radius, d;
+   Scalar r = guessed ? start_radius : input_parameters.initial_radius, d;
+   Scalar r_tried = r;
    Vector3 q, c_next;
-   int qidx = -1, qidx_next;
+   Index qidx = -1, qidx_next;
    Point c; c.getVector3fMap() = p - n * r;
 
    // We can't continue if we have bad input, we won't be able to perform nearest neighbour searches
    if (!c.getVector3fMap().allFinite())
       return{ nanPoint, -1 };
 
-   // Results from our search
-   std::vector<int> k_indices(1);
-   std::vector<Scalar> k_distances(1);
+   // Every next ball touches p and is smaller than the current one, so it lies inside the current ball.
+   // Once the points in the current ball fit in a short list we keep searching that list instead of the tree.
+   bool use_candidates = false;
+   Scalar gather_below = r;
 
    while (true) {
-      // find closest point to c
-      kd_tree->nearestKSearch(c, 1, k_indices, k_distances);
-
-      qidx_next = k_indices[0];
-      q = kd_tree->getInputCloud()->at(qidx_next).getVector3fMap();
-      d = k_distances[0];
+      // find closest point to c, only points closer than the current radius can shrink the ball
+      Scalar max_d = (r - delta_convergance)*(r - delta_convergance);
+      if (use_candidates) {
+         Scalar keep = r + candidate_margin(c.getVector3fMap(), r);
+         int k = candidates.nearest(c.getVector3fMap(), d, max_d, keep * keep);
+         qidx_next = k == -1 ? -1 : candidates.index[k];
+      } else
+         qidx_next = kd_tree.nearest(c.getVector3fMap(), d, max_d);
 
       // This should handle all (special) cases where we want to break the loop
       // - normal case when ball no longer shrinks
       // - the case where q==p
       // - any duplicate point cases
-      if ((d >= (r-delta_convergance)*(r-delta_convergance)) || (p==q))
-            break;
+      if (qidx_next == -1)
+         break;
+      q = kd_tree.cloud()[qidx_next].getVector3fMap();
+      if (p == q)
+         break;
 
       // Compute next ball center
-      r = compute_radius(p, n, q);
-      c_next = p - n * r;
+      Scalar r_next = compute_radius(p, n, q);
+      c_next = p - n * r_next;
+      r_tried = r_next;
 
       if (!c_next.allFinite())
          break;
 
       // Denoising
-      if (input_parameters.denoise_preserve || input_parameters.denoise_planar) {
-         Scalar a = cos_angle(p - c_next, q - c_next);
-         Scalar separation_angle = std::acos(a);
-
-         if (j == 0 && input_parameters.denoise_planar > 0 && separation_angle < input_parameters.denoise_planar) {
-            break;
-         }
-         if (j > 0 && input_parameters.denoise_preserve > 0 && (separation_angle < input_parameters.denoise_preserve && r > (q - p).norm())) {
-            break;
-         }
-      }
+      if (denoise_reject(denoise, p, q, c_next, r_next, j))
+         break;
 
       // Stop iteration if this looks like an infinite loop:
       if (j > iteration_limit)
          break;
 
+      // only an accepted ball counts, so that the radius we report is the one of c
       c.getVector3fMap() = c_next;
+      r = r_next;
       qidx = qidx_next;
       j++;
+
+      // When the ball was too full, wait until its radius has halved before trying again
+      if (!use_candidates && r < gather_below) {
+         Scalar gather = r + candidate_margin(c_next, r);
+         use_candidates = kd_tree.points_in_ball(c_next, gather * gather, candidate_limit, candidates);
+         gather_below = r / 2;
+      }
    }
 
+   if (j == 0 && guessed)
+      return sb_point(input_parameters, denoise, p, n, kd_tree, candidates);
+
    if (j == 0 && input_parameters.nan_for_initr)
       return{ nanPoint, -1,-1 };
    else
-      return{ c, qidx, r };
+      return{ c, qidx, r, r_tried };
 }
 
-void sb_points(ma_parameters &input_parameters, ma_data &madata, bool inner, progress_callback callback) {
-   // outer mat should be written to second half of ma_coords/ma_qidx
-   size_t offset = 0;
-   if (inner == false)
-      offset = madata.coords->size();
+ma_result sb_point_minradius(const ma_parameters &input_parameters, const denoise_thresholds &denoise, const Vector3 &p, const Vector3 &n, const flat_kdtree &kd_tree, flat_kdtree::point_list &candidates, Scalar start_radius = 0) {
+   // Find the final ball of the shrinking ball algorithm directly, as the smallest ball through p
+   // and any other point with its center on the normal.
+   Scalar r = input_parameters.initial_radius - delta_convergance;
+   Point c; c.getVector3fMap() = p - n * input_parameters.initial_radius;
+
+   if (!c.getVector3fMap().allFinite())
+      return{ nanPoint, -1 };
 
-   size_t progress = offset;
+   // A smaller start_radius only tightens the search, if that ball is empty we search again
+   Index qidx = -1;
+   if (start_radius > 0 && start_radius < input_parameters.initial_radius) {
+      Scalar r_guess = start_radius - delta_convergance;
+      qidx = kd_tree.min_tangent_ball(p, n, r_guess);
+      if (qidx != -1)
+         r = r_guess;
+   }
+   if (qidx == -1)
+      qidx = kd_tree.min_tangent_ball(p, n, r);
+   if (qidx == -1) {
+      // the initial ball is empty
+      if (input_parameters.nan_for_initr)
+         return{ nanPoint, -1, -1 };
+      return{ c, -1, input_parameters.initial_radius };
+   }
+   Vector3 c_min = p - n * r;
+   if (!c_min.allFinite())
+      return sb_point(input_parameters, denoise, p, n, kd_tree, candidates);
+   c.getVector3fMap() = c_min;
+
+   // Denoising, the intermediate balls are unknown here. If the final ball would be rejected we let
+   // the shrinking ball algorithm find out which ball to keep instead.
+   Vector3 q = kd_tree.cloud()[qidx].getVector3fMap();
+   if (denoise_reject(denoise, p, q, c_min, r, 0) || denoise_reject(denoise, p, q, c_min, r, 1))
+      return sb_point(input_parameters, denoise, p, n, kd_tree, candidates);
+
+   return{ c, qidx, r, r };
+}
+
+void sb_points(ma_parameters &input_parameters, ma_data &madata, progress_callback callback) {
+   // With both sides the exterior balls are written to the second half of ma_coords/ma_qidx/ma_radius
+   size_t N = madata.coords->size();
+   bool inner = (madata.sides & MA_INNER) != 0;
+   bool outer = (madata.sides & MA_OUTER) != 0;
+   size_t outer_offset = inner ? N : 0;
+
+   // With a warm start the points are visited in Morton order, so that the previous ball computed
+   // by the same thread is usually a close neighbour. Its radius is a good guess for the next ball.
+   // Points that went through morton_sort() are in that order already.
+   std::vector<Index> order;
+   if (input_parameters.warm_start && madata.order.empty())
+      morton_order(*madata.coords, order);
+
+   denoise_thresholds denoise = make_denoise_thresholds(input_parameters.denoise_planar, input_parameters.denoise_preserve);
+
+   size_t progress = 0;
    size_t accum = 0;
-#pragma omp parallel for firstprivate(accum)
-   for (int i = 0; i < madata.coords->size(); i++)
+   Scalar previous_radius[2] = { 0, 0 };
+   flat_kdtree::point_list candidates;
+#pragma omp parallel for schedule(static) firstprivate(accum, previous_radius) private(candidates)
+   for (Index k = 0; k < N; k++)
    {
+      Index i = order.empty() ? k : order[k];
       Vector3 p = (*madata.coords)[i].getVector3fMap();
-      Vector3 n;
-      if (inner)
-         n = (*madata.normals)[i].getNormalVector3fMap();
-      else
-         n = -(*madata.normals)[i].getNormalVector3fMap();
-
-      ma_result r = sb_point(input_parameters, p, n, madata.kd_tree);
-
-      (*madata.ma_coords)[i + offset] = r.c;
-      madata.ma_qidx[i + offset] = r.qidx;
-	  madata.ma_radius[i + offset] = r.radius;
+      Vector3 normal = point_normal(madata, i);
+
+      // Compute the interior and exterior ball of a point back to back, while its neighbourhood is in cache
+      for (int side = 0; side < 2; side++) {
+         if (!(side == 0 ? inner : outer))
+            continue;
+         Vector3 n = side == 0 ? normal : Vector3(-normal);
+         size_t offset = side == 0 ? 0 : outer_offset;
+
+         Scalar start_radius = warm_start_factor * previous_radius[side];
+
+         ma_result r;
+         if (input_parameters.engine == MA_ENGINE_MINRADIUS)
+            r = sb_point_minradius(input_parameters, denoise, p, n, *madata.kd_tree, candidates, start_radius);
+         else
+            r = sb_point(input_parameters, denoise, p, n, *madata.kd_tree, candidates, start_radius);
+
+         if (input_parameters.warm_start)
+            previous_radius[side] = r.qidx == -1 ? 0 : r.tried_radius;
+
+         (*madata.ma_coords)[i + offset] = r.c;
+         madata.ma_qidx[i + offset] = r.qidx;
+         madata.ma_radius[i + offset] = r.radius;
+         accum++;
+      }
 
-      accum++;
-      if (accum == 5000)
+      if (accum >= 5000)
       {
 #pragma omp critical
          {
@@ -165,13 +275,169 @@ void sb_points(ma_parameters &input_parameters, ma_data &madata, bool inner, pro
    }
 }
 
+// A ball of the wavefront engine that is still shrinking
+struct wave_ball {
+   Vector3 p, n, c;
+   Scalar r;
+   Index qidx;
+   unsigned int j;
+   size_t slot; // index of the result in ma_coords/ma_qidx/ma_radius
+   bool done;
+};
+
+void sb_points_wavefront(ma_parameters &input_parameters, ma_data &madata, progress_callback callback) {
+   // Advances all balls one iteration at a time instead of shrinking one ball to completion. Before every
+   // wave the active balls are sorted by the Morton code of their centers, so that the threads answer
+   // queries for nearby centers one after another and walk the same kd-tree nodes. Balls that are final
+   // are written out and dropped from the active set.
+   size_t N = madata.coords->size();
+   bool inner = (madata.sides & MA_INNER) != 0;
+   bool outer = (madata.sides & MA_OUTER) != 0;
+   size_t outer_offset = inner ? N : 0;
+   const flat_kdtree &kd_tree = *madata.kd_tree;
+
+   std::vector<wave_ball> active(ma_size(madata));
+#pragma omp parallel for
+   for (Index i = 0; i < N; i++) {
+      Vector3 p = (*madata.coords)[i].getVector3fMap();
+      Vector3 normal = point_normal(madata, i);
+      for (int side = 0; side < 2; side++) {
+         if (!(side == 0 ? inner : outer))
+            continue;
+         size_t slot = i + (side == 0 ? 0 : outer_offset);
+         wave_ball &b = active[slot];
+         b.p = p;
+         b.n = side == 0 ? normal : Vector3(-normal);
+         b.c = p - b.n * input_parameters.initial_radius;
+         b.r = input_parameters.initial_radius;
+         b.qidx = -1;
+         b.j = 0;
+         b.slot = slot;
+         // We can't continue if we have bad input, we won't be able to perform nearest neighbour searches
+         b.done = !b.c.allFinite();
+         if (b.done) {
+            (*madata.ma_coords)[slot] = nanPoint;
+            madata.ma_qidx[slot] = -1;
+            madata.ma_radius[slot] = 0;
+         }
+      }
+   }
+   active.erase(std::remove_if(active.begin(), active.end(), [](const wave_ball &b) { return b.done; }), active.end());
+
+   size_t progress = ma_size(madata) - active.size();
+   denoise_thresholds denoise = make_denoise_thresholds(input_parameters.denoise_planar, input_parameters.denoise_preserve);
+   PointCloud centers;
+   std::vector<Index> order;
+   std::vector<wave_ball> wave;
+#ifdef VERBOSEPRINT
+   unsigned int wave_count = 0;
+#endif
+   while (!active.empty()) {
+      centers.resize(active.size());
+#pragma omp parallel for
+      for (Index k = 0; k < active.size(); k++)
+         centers[k].getVector3fMap() = active[k].c;
+      morton_order(centers, order);
+
+      wave.resize(active.size());
+#pragma omp parallel for
+      for (Index k = 0; k < active.size(); k++)
+         wave[k] = active[order[k]];
+
+      // Static scheduling hands each thread a contiguous run of the sorted centers. It queries them in
+      // batches, so that the kd-tree traversals within a batch can overlap their cache misses.
+      Index batches = Index((wave.size() + query_batch - 1) / query_batch);
+#pragma omp parallel for schedule(static)
+      for (Index k = 0; k < batches; k++) {
+         size_t begin = k * query_batch, end = std::min(begin + query_batch, wave.size());
+         flat_kdtree::nn_query queries[query_batch];
+         sb_batch batch;
+         size_t lane[query_batch];
+         for (size_t i = begin; i < end; i++) {
+            queries[i - begin].point = wave[i].c;
+            queries[i - begin].max_sqr_dist = (wave[i].r - delta_convergance)*(wave[i].r - delta_convergance);
+         }
+         kd_tree.nearest_batch(queries, end - begin);
+
+         // The balls whose search found a point other than p shrink further, in one packet
+         size_t lanes = 0;
+         for (size_t i = begin; i < end; i++) {
+            wave_ball &b = wave[i];
+            Index qidx_next = queries[i - begin].index;
+            if (qidx_next != -1) {
+               Vector3 q = kd_tree.cloud()[qidx_next].getVector3fMap();
+               if (b.p != q) {
+                  lane[lanes] = i;
+                  batch.px[lanes] = b.p[0]; batch.py[lanes] = b.p[1]; batch.pz[lanes] = b.p[2];
+                  batch.nx[lanes] = b.n[0]; batch.ny[lanes] = b.n[1]; batch.nz[lanes] = b.n[2];
+                  batch.qx[lanes] = q[0]; batch.qy[lanes] = q[1]; batch.qz[lanes] = q[2];
+                  batch.j[lanes] = b.j;
+                  lanes++;
+                  continue;
+               }
+            }
+            b.done = true;
+         }
+         sb_step_batch(denoise, iteration_limit, batch, lanes);
+
+         for (size_t l = 0; l < lanes; l++) {
+            wave_ball &b = wave[lane[l]];
+            if (batch.stop[l]) {
+               b.done = true;
+               continue;
+            }
+            b.r = batch.r[l];
+            b.c = Vector3(batch.cx[l], batch.cy[l], batch.cz[l]);
+            b.qidx = queries[lane[l] - begin].index;
+            b.j++;
+         }
+
+         for (size_t i = begin; i < end; i++) {
+            const wave_ball &b = wave[i];
+            if (!b.done)
+               continue;
+            if (b.j == 0 && input_parameters.nan_for_initr) {
+               (*madata.ma_coords)[b.slot] = nanPoint;
+               madata.ma_qidx[b.slot] = -1;
+               madata.ma_radius[b.slot] = -1;
+            } else {
+               (*madata.ma_coords)[b.slot].getVector3fMap() = b.c;
+               madata.ma_qidx[b.slot] = b.qidx;
+               madata.ma_radius[b.slot] = b.r;
+            }
+         }
+      }
+
+      active.clear();
+      std::remove_copy_if(wave.begin(), wave.end(), std::back_inserter(active), [](const wave_ball &b) { return b.done; });
+      progress += wave.size() - active.size();
+      if (callback)
+         callback(progress);
+#ifdef VERBOSEPRINT
+      wave_count++;
+#endif
+   }
+#ifdef VERBOSEPRINT
+   std::cout << "Wavefront engine finished after " << wave_count << " waves, using " << sb_kernel_name() << " kernels" << std::endl;
+#endif
+}
+
 void compute_masb_points(ma_parameters &input_parameters, ma_data &madata, progress_callback callback) {
 #ifdef VERBOSEPRINT
    auto start_time = Clock::now();
 #endif
 
+   // Only allocate room for the selected sides
+   madata.sides = input_parameters.sides ? input_parameters.sides : MA_INNER;
+   size_t ma_count = ma_size(madata);
+   if (!madata.ma_coords)
+      madata.ma_coords.reset(new PointCloud);
+   madata.ma_coords->resize(ma_count);
+   madata.ma_qidx.resize(ma_count);
+   madata.ma_radius.resize(ma_count);
+
    if (!madata.kd_tree) {
-      madata.kd_tree.reset(new pcl::search::KdTree<Point>());
+      madata.kd_tree.reset(new flat_kdtree());
       madata.kd_tree->setInputCloud(madata.coords);
 #ifdef VERBOSEPRINT
       auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
@@ -180,19 +446,15 @@ void compute_masb_points(ma_parameters &input_parameters, ma_data &madata, progr
 #endif
    }
 
-   // Inside processing
-   sb_points(input_parameters, madata, 1, callback);
+   // Inside and/or outside processing
+   if (input_parameters.engine == MA_ENGINE_WAVEFRONT)
+      sb_points_wavefront(input_parameters, madata, callback);
+   else
+      sb_points(input_parameters, madata, callback);
 #ifdef VERBOSEPRINT
    auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
-   std::cout << "Done shrinking interior balls, took " << elapsed_time.count() << " ms" << std::endl;
-   start_time = Clock::now();
-#endif
-
-   // Outside processing
-   //sb_points(input_parameters, madata, 0, callback);
-#ifdef VERBOSEPRINT
-   elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
-   std::cout << "Done shrinking exterior balls, took " << elapsed_time.count() << " ms" << std::endl;
+   std::cout << "Done shrinking " << (madata.sides == MA_BOTH ? "interior and exterior" : madata.sides == MA_INNER ? "interior" : "exterior")
+      << " balls, took " << elapsed_time.count() << " ms" << std::endl;
 #endif
 }
 
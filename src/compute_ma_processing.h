@@ -27,21 +27,34 @@ SOFTWARE.
 
 #include <functional>
 
+enum ma_engine {
+   MA_ENGINE_SHRINK,   // shrinking ball, one nearest neighbour search per iteration
+   MA_ENGINE_MINRADIUS, // one branch-and-bound search for the smallest tangent ball
+   MA_ENGINE_WAVEFRONT  // shrinking ball, all balls advance one iteration at a time in Morton order
+};
+
 struct ma_parameters {
    Scalar initial_radius;
    bool nan_for_initr;
    double denoise_preserve;
    double denoise_planar;
+   ma_engine engine;
+   bool warm_start;    // start from the radius of the previously computed, nearby ball, not used by the wavefront engine
+   ma_sides sides;     // compute the interior balls, the exterior balls or both
 };
 
 struct ma_result {
    Point c;
-   int qidx;
+   Index qidx;
    double radius;
+   // radius of the last ball that was tried, which may have been rejected. It makes a better warm start
+   // for a neighbouring point than the final radius.
+   Scalar tried_radius;
 };
 
 using progress_callback = std::function<void(size_t progress)>;
 
+// Allocates ma_coords, ma_qidx and ma_radius in madata for the selected sides and fills them
 void compute_masb_points(ma_parameters &input_parameters, ma_data &madata, progress_callback callback = {});
 
 #endif
@@ -29,7 +29,9 @@ SOFTWARE.
 #include "compute_normals_processing.h"
 #include "io.h"
 #include "madata.h"
+#include "morton.h"
 #include "types.h"
+#include "xyz_writer.h"
 
 int main(int argc, char **argv) {
    // parse command line arguments
@@ -41,6 +43,18 @@ int main(int argc, char **argv) {
 
       TCLAP::ValueArg<int> kArg("k", "kneighbours", "number of nearest neighbours to use for PCA", false, 10, "int", cmd);
 
+      TCLAP::ValueArg<std::string> lasArg("", "las", "read the points from this LAS file instead of 'coords.npy', relative to the center of their bounding box (written to 'origin.npy')", false, "", "las file", cmd);
+      TCLAP::ValueArg<std::string> plyArg("", "ply", "read the points from the vertices of this binary PLY file instead of 'coords.npy'", false, "", "ply file", cmd);
+      TCLAP::ValueArg<std::string> plyOutArg("", "ply_out", "also write the points and normals as vertices of this binary PLY file", false, "", "ply file", cmd);
+      TCLAP::ValueArg<std::string> npzArg("", "npz", "write the normals array into this zip compressed .npz archive instead of 'normals.npy' in the output directory", false, "", "npz file", cmd);
+      std::vector<int> normal_bits;
+      normal_bits.push_back(16);
+      normal_bits.push_back(32);
+      TCLAP::ValuesConstraint<int> normalBitsConstraint(normal_bits);
+      TCLAP::ValueArg<int> octNormalsArg("", "oct_normals", "write the normals in octahedral encoding of 16 or 32 bits, as a 1D uint16 or uint32 array, instead of Nx3 floats", false, 32, &normalBitsConstraint, cmd);
+      TCLAP::SwitchArg mortonSwitch("z", "morton", "sort the points in Morton (Z-order) before processing so that nearby points are processed together, which is faster for large point clouds. The outputs keep the input order", cmd, false);
+      TCLAP::SwitchArg kdtreeCacheSwitch("", "kdtree_cache", "read the kd-tree over the points from a file in the input directory that an earlier run with the same points and -z setting wrote, or build it and write that file. Saves the tree construction when the same points are processed again", cmd, false);
+
       cmd.parse(argc, argv);
 
       normals_parameters normal_params;
@@ -54,20 +68,41 @@ int main(int argc, char **argv) {
       io_params.coords = true;
 
       ma_data madata = {};
-      npy2madata(inputArg.getValue(), madata, io_params);
+      if (lasArg.isSet())
+         las2madata(lasArg.getValue(), madata);
+      else if (plyArg.isSet())
+         ply2madata(plyArg.getValue(), madata, io_params);
+      else
+         npy2madata(inputArg.getValue(), madata, io_params);
 
       std::cout << "Point count: " << madata.coords->size() << std::endl;
 
+      if (mortonSwitch.getValue())
+         morton_sort(madata);
+      if (kdtreeCacheSwitch.getValue())
+         attach_kdtree(inputArg.getValue(), madata);
+
       // Perform the actual processing
       madata.normals.reset(new NormalCloud);
       compute_normals(normal_params, madata);
+      restore_order(madata);
+      if (octNormalsArg.isSet())
+         pack_normals(madata, octNormalsArg.getValue());
 
       io_params.coords = false;
       io_params.normals = true;
-      madata2npy(output_path, madata, io_params);
-
-      // For convenience, convert the input .npy to .xyz
-      convertNPYtoXYZ(inputArg.getValue());
+      if (npzArg.isSet())
+         madata2npz(npzArg.getValue(), madata, io_params);
+      else
+         madata2npy(output_path, madata, io_params);
+      if (plyOutArg.isSet()) {
+         io_params.coords = true;
+         madata2ply(plyOutArg.getValue(), madata, io_params);
+      }
+
+      // For convenience, also write the input points to .xyz
+      if (!lasArg.isSet() && !plyArg.isSet())
+         write_xyz(inputArg.getValue() + "/coords.xyz", *madata.coords);
    }
    catch (TCLAP::ArgException &e) { std::cerr << "Error: " << e.error() << " for " << e.argId() << std::endl; }
 
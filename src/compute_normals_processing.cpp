@@ -61,7 +61,7 @@ void compute_normals(normals_parameters &input_parameters, ma_data &madata) {
 #endif
 
    if (!madata.kd_tree) {
-      madata.kd_tree.reset(new pcl::search::KdTree<Point>());
+      madata.kd_tree.reset(new flat_kdtree());
       madata.kd_tree->setInputCloud(madata.coords);
 #ifdef VERBOSEPRINT
       auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
@@ -22,284 +22,1120 @@ SOFTWARE.
 
 #include "io.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <limits>
+#include <memory>
+#include <sstream>
 #include <string>
 
-#include <cnpy/cnpy.h>
-
 #include "madata.h"
+#include "mapped_file.h"
+#include "npy_view.h"
+#include "npz_writer.h"
+#include "oct_normals.h"
 #include "types.h"
+#include "xyz_writer.h"
 
-inline cnpy::NpyArray read_npyarray(std::string input_file_path) {
-   // windows fix
-   std::replace(input_file_path.begin(), input_file_path.end(), '\\', '/');
-   // check if file exists
-   {
-      std::ifstream infile(input_file_path.c_str());
-      if (!infile) {
-         std::cerr << "Invalid file path " << input_file_path << std::endl;
-         exit(1);
+// File name suffix and description of the medial balls of one side
+inline std::string side_suffix(int side) { return side == MA_INNER ? "_in" : "_out"; }
+inline std::string side_name(int side) { return side == MA_INNER ? "inner" : "outer"; }
+
+inline bool file_exists(const std::string &path) {
+   return bool(std::ifstream(path.c_str()));
+}
+
+// The requested sides, or if none are requested the sides for which path_prefix_in/out.npy or, when
+// given, alternative_prefix_in/out.npy exist
+ma_sides select_sides(std::string path_prefix, int requested, std::string alternative_prefix = "") {
+   if (requested)
+      return ma_sides(requested);
+
+   int sides = 0;
+   for (int side = MA_INNER; side <= MA_OUTER; side++)
+      if (file_exists(path_prefix + side_suffix(side) + ".npy")
+         || (!alternative_prefix.empty() && file_exists(alternative_prefix + side_suffix(side) + ".npy")))
+         sides |= side;
+   // if there are no files, reading the inner ones reports the error
+   return sides ? ma_sides(sides) : MA_INNER;
+}
+
+// Where madata2npy() and madata2npz() put the arrays. An array is opened as a buffer that all threads
+// fill, and is complete once it is closed.
+class array_output {
+public:
+   virtual ~array_output() {}
+   virtual void *open(const std::string &name, char type, size_t word_size, size_t rows, size_t columns) = 0;
+   virtual void close() = 0;
+
+   template <class T>
+   T *open_as(const std::string &name, char type, size_t rows, size_t columns) {
+      return static_cast<T *>(open(name, type, sizeof(T), rows, columns));
+   }
+};
+
+// One mapped name.npy file per array in a directory
+class npy_directory : public array_output {
+public:
+   explicit npy_directory(std::string path) : path_(path) {}
+   void *open(const std::string &name, char type, size_t word_size, size_t rows, size_t columns) {
+      writer_.reset(new npy_writer(path_ + "/" + name + ".npy", type, word_size, rows, columns));
+      return writer_->data();
+   }
+   void close() { writer_.reset(); }
+
+private:
+   std::string path_;
+   std::unique_ptr<npy_writer> writer_;
+};
+
+// One name.npy member per array in a compressed archive
+class npz_archive : public array_output {
+public:
+   explicit npz_archive(std::string path) : npz_(path) {}
+   void *open(const std::string &name, char type, size_t word_size, size_t rows, size_t columns) {
+      return npz_.begin_array(name, type, word_size, rows, columns);
+   }
+   void close() { npz_.end_array(); }
+
+private:
+   npz_writer npz_;
+};
+
+// Writes a 1D array of n values with the given numpy type character
+template <class T>
+void write_array(array_output &output, const std::string &name, char type, const T *values, size_t n) {
+   T* out = output.open_as<T>(name, type, n, 0);
+#pragma omp parallel for
+   for (Index i = 0; i < n; i++)
+      out[i] = values[i];
+   output.close();
+}
+
+// Copies n point indices stored as T into out. Files written with 64 bit indices are accepted as long as
+// their values fit in Index.
+template <class T>
+void read_indices(const npy_view &npy, const std::string &path, Index *out, size_t n) {
+   const T* in = npy.as<T>();
+   bool fits = true;
+#pragma omp parallel for reduction(&&:fits)
+   for (Index i = 0; i < n; i++) {
+      out[i] = Index(in[i]);
+      fits = fits && out[i] == in[i];
+   }
+   if (!fits) {
+      std::cerr << "Point indices in " << path << " exceed the range of this build, rebuild with MASB_INDEX64" << std::endl;
+      exit(1);
+   }
+}
+
+// The oct_normals line of the metadata that compute_ma writes next to its output in dir: the bits of the
+// encoding the normals were kept in, 0 for floats, or -1 if there is no such line
+int recorded_normal_bits(const std::string &dir) {
+   std::ifstream metadata((dir + "/compute_ma").c_str());
+   std::string key;
+   int bits;
+   while (metadata >> key) {
+      if (key == "oct_normals" && metadata >> bits)
+         return bits;
+      metadata.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+   }
+   return -1;
+}
+
+// Computes the ma coords of one side from the points, the normals in normals.npy and the radii in
+// ma_radius_in/out.npy: every center lies on the normal of its point, at p - n * r for the interior balls
+// and with the normal flipped for the exterior ones, in the same operations as compute_ma. Balls that
+// were left out with a radius of -1 (compute_ma --nan) get a nan center. Float normals that compute_ma
+// kept in octahedral encoding (--oct_normals) go through the same encoding here.
+void rebuild_ma_coords(const std::string &input_dir_path, ma_data &madata, int side, size_t offset) {
+   std::cout << "Rebuilding " << side_name(side) << " ma coords from the radii..." << std::endl;
+
+   size_t N = madata.coords->size();
+   npy_view radius_npy(input_dir_path + "/ma_radius" + side_suffix(side) + ".npy");
+   radius_npy.require('f', 4, 0);
+   npy_view normals_npy(input_dir_path + "/normals.npy");
+   bool packed = normals_npy.type() == 'u';
+   if (packed)
+      normals_npy.require('u', normals_npy.word_size() == 2 ? 2 : 4, 0);
+   else
+      normals_npy.require('f', 4, 3);
+   if (radius_npy.shape()[0] != N || normals_npy.shape()[0] != N) {
+      std::cerr << "Mismatched number of coords and " << side_name(side) << " ma radii or normals" << std::endl;
+      exit(1);
+   }
+
+   // Packed normals are used as they are, so they must still be in the encoding compute_ma read them in
+   int bits = recorded_normal_bits(input_dir_path);
+   if (packed && bits != -1 && bits != 8 * int(normals_npy.word_size())) {
+      std::cerr << "normals.npy is not in the encoding compute_ma used (oct_normals " << bits << "), can't rebuild the ma coords" << std::endl;
+      exit(1);
+   }
+
+   const float* radius = radius_npy.as<float>();
+   const float nan = std::numeric_limits<float>::quiet_NaN();
+#pragma omp parallel for
+   for (Index i = 0; i < N; i++) {
+      Vector3 n;
+      if (!packed) {
+         const float* v = normals_npy.as<float>() + 3 * size_t(i);
+         if (bits == 32)
+            n = oct_decode32(oct_encode32(v[0], v[1], v[2]));
+         else if (bits == 16)
+            n = oct_decode16(oct_encode16(v[0], v[1], v[2]));
+         else
+            n = Vector3(v[0], v[1], v[2]);
+      }
+      else if (normals_npy.word_size() == 4)
+         n = oct_decode32(normals_npy.as<uint32_t>()[i]);
+      else
+         n = oct_decode16(normals_npy.as<uint16_t>()[i]);
+      if (side == MA_OUTER)
+         n = -n;
+
+      Point &c = (*madata.ma_coords)[i + offset];
+      if (radius[i] < 0)
+         c = Point(nan, nan, nan);
+      else {
+         Vector3 p = (*madata.coords)[i].getVector3fMap();
+         c.getVector3fMap() = p - n * radius[i];
       }
    }
-   // std::cout << "Reading array from " << input_file_path <<std::endl;
-   cnpy::NpyArray npy_array = cnpy::npy_load(input_file_path.c_str());
-   return npy_array;
 }
 
 void npy2madata(std::string input_dir_path, ma_data &madata, io_parameters &params) {
+   // The files are mapped and copied straight into the point clouds, there is no intermediate buffer
    if (params.coords) {
       std::cout << "Reading coords array..." << std::endl;
 
-      cnpy::NpyArray npy_array = read_npyarray(input_dir_path + "/coords.npy");
-      float* coords_carray = reinterpret_cast<float*>(npy_array.data);
+      npy_view npy(input_dir_path + "/coords.npy");
+      npy.require('f', 4, 3);
+      const float* coords_carray = npy.as<float>();
+
+      // every point and both of its medial balls need an Index
+      if (2 * npy.shape()[0] > size_t(std::numeric_limits<Index>::max())) {
+         std::cerr << "Too many points for " << 8 * sizeof(Index) << " bit indices, rebuild with MASB_INDEX64" << std::endl;
+         exit(1);
+      }
 
       madata.coords.reset(new PointCloud);
-      madata.coords->reserve(npy_array.shape[0]);
+      madata.coords->resize(npy.shape()[0]);
 
-      for (size_t i = 0; i < npy_array.shape[0]; i++)
-         madata.coords->push_back(Point(
-            coords_carray[i * 3 + 0],
-            coords_carray[i * 3 + 1],
-            coords_carray[i * 3 + 2]
-         ));
-      npy_array.destruct();
+#pragma omp parallel for
+      for (Index i = 0; i < madata.coords->size(); i++) {
+         const float* v = coords_carray + 3 * size_t(i);
+         (*madata.coords)[i] = Point(v[0], v[1], v[2]);
+      }
    }
 
    if (params.normals) {
       std::cout << "Reading normals array..." << std::endl;
 
-      cnpy::NpyArray npy_array = read_npyarray(input_dir_path + "/normals.npy");
-      float* normals_carray = reinterpret_cast<float*>(npy_array.data);
+      npy_view npy(input_dir_path + "/normals.npy");
+      size_t N = madata.coords->size();
+      madata.normals.reset();
+      madata.packed_normals.clear();
 
-      if (npy_array.shape[0] != madata.coords->size()) {
-         std::cerr << "Mismatched number of coords and normals" << std::endl;
-         exit(1);
-      }
+      if (npy.type() == 'u') {
+         // Octahedral encoded normals (a 1D uint16 or uint32 array) are kept that way
+         npy.require('u', npy.word_size() == 2 ? 2 : 4, 0);
+         if (npy.shape()[0] != N) {
+            std::cerr << "Mismatched number of coords and normals" << std::endl;
+            exit(1);
+         }
+         madata.packed_normals.bits = int(8 * npy.word_size());
+         if (npy.word_size() == 4)
+            madata.packed_normals.oct32.assign(npy.as<uint32_t>(), npy.as<uint32_t>() + N);
+         else
+            madata.packed_normals.oct16.assign(npy.as<uint16_t>(), npy.as<uint16_t>() + N);
+      } else {
+         npy.require('f', 4, 3);
+         const float* normals_carray = npy.as<float>();
+         if (npy.shape()[0] != N) {
+            std::cerr << "Mismatched number of coords and normals" << std::endl;
+            exit(1);
+         }
 
-      madata.normals.reset(new NormalCloud);
-      madata.normals->reserve(madata.coords->size());
+         // When they are to be packed, the normals are encoded straight from the file
+         oct_normals &packed = madata.packed_normals;
+         packed.bits = params.normal_bits;
+         if (packed.bits == 32)
+            packed.oct32.resize(N);
+         else if (packed.bits == 16)
+            packed.oct16.resize(N);
+         else {
+            madata.normals.reset(new NormalCloud);
+            madata.normals->resize(N);
+         }
 
-      for (size_t i = 0; i < madata.coords->size(); i++)
-         madata.normals->push_back(Normal(
-            normals_carray[i * 3 + 0],
-            normals_carray[i * 3 + 1],
-            normals_carray[i * 3 + 2]
-         ));
-      npy_array.destruct();
+#pragma omp parallel for
+         for (Index i = 0; i < N; i++) {
+            const float* v = normals_carray + 3 * size_t(i);
+            if (packed.bits == 32)
+               packed.oct32[i] = oct_encode32(v[0], v[1], v[2]);
+            else if (packed.bits == 16)
+               packed.oct16[i] = oct_encode16(v[0], v[1], v[2]);
+            else
+               (*madata.normals)[i] = Normal(v[0], v[1], v[2]);
+         }
+      }
    }
 
+   // ma coords that were left out (see compute_ma --radius_only) are rebuilt from the radii
+   if (params.ma_coords || params.ma_qidx)
+      madata.sides = params.ma_coords
+         ? select_sides(input_dir_path + "/ma_coords", params.sides, input_dir_path + "/ma_radius")
+         : select_sides(input_dir_path + "/ma_qidx", params.sides);
+
+   // With both sides the exterior balls are stored after the interior ones
+   size_t N = madata.coords->size();
+   size_t outer_offset = (madata.sides & MA_INNER) ? N : 0;
+
    if (params.ma_coords) {
       std::cout << "Reading ma coords arrays..." << std::endl;
 
-      cnpy::NpyArray in_npy_array = read_npyarray(input_dir_path + "/ma_coords_in.npy");
-      float* in_ma_coords_carray = reinterpret_cast<float*>(in_npy_array.data);
-
-      if (in_npy_array.shape[0] != madata.coords->size()) {
-         std::cerr << "Mismatched number of coords and inner ma coords" << std::endl;
-         exit(1);
-      }
+      madata.ma_coords.reset(new PointCloud);
+      madata.ma_coords->resize(ma_size(madata));
 
-      cnpy::NpyArray out_npy_array = read_npyarray(input_dir_path + "/ma_coords_out.npy");
-      float* out_ma_coords_carray = reinterpret_cast<float*>(out_npy_array.data);
+      for (int side = MA_INNER; side <= MA_OUTER; side++) {
+         if (!(madata.sides & side))
+            continue;
+         size_t offset = side == MA_INNER ? 0 : outer_offset;
 
-      if (out_npy_array.shape[0] != madata.coords->size()) {
-         std::cerr << "Mismatched number of coords and outer ma coords" << std::endl;
-         exit(1);
-      }
+         std::string path = input_dir_path + "/ma_coords" + side_suffix(side) + ".npy";
+         if (!file_exists(path)) {
+            rebuild_ma_coords(input_dir_path, madata, side, offset);
+            continue;
+         }
 
-      madata.ma_coords.reset(new PointCloud);
-      madata.ma_coords->reserve(2 * madata.coords->size());
+         npy_view npy(path);
+         npy.require('f', 4, 3);
+         const float* ma_coords_carray = npy.as<float>();
 
-      for (size_t i = 0; i < madata.coords->size(); i++)
-         madata.ma_coords->push_back(Point(
-            in_ma_coords_carray[i * 3 + 0],
-            in_ma_coords_carray[i * 3 + 1],
-            in_ma_coords_carray[i * 3 + 2]
-         ));
-      in_npy_array.destruct();
+         if (npy.shape()[0] != N) {
+            std::cerr << "Mismatched number of coords and " << side_name(side) << " ma coords" << std::endl;
+            exit(1);
+         }
 
-      for (size_t i = 0; i < madata.coords->size(); i++)
-         madata.ma_coords->push_back(Point(
-            out_ma_coords_carray[i * 3 + 0],
-            out_ma_coords_carray[i * 3 + 1],
-            out_ma_coords_carray[i * 3 + 2]
-         ));
-      out_npy_array.destruct();
+#pragma omp parallel for
+         for (Index i = 0; i < N; i++) {
+            const float* v = ma_coords_carray + 3 * size_t(i);
+            (*madata.ma_coords)[i + offset] = Point(v[0], v[1], v[2]);
+         }
+      }
    }
 
    if (params.ma_qidx) {
       std::cout << "Reading q index arrays..." << std::endl;
 
-      cnpy::NpyArray in_npy_array = read_npyarray(input_dir_path + "/ma_qidx_in.npy");
-      int* in_qidx_carray = reinterpret_cast<int*>(in_npy_array.data);
+      madata.ma_qidx.resize(ma_size(madata));
 
-      if (in_npy_array.shape[0] != madata.coords->size()) {
-         std::cerr << "Mismatched number of coords and inner q indices" << std::endl;
-         exit(1);
-      }
+      for (int side = MA_INNER; side <= MA_OUTER; side++) {
+         if (!(madata.sides & side))
+            continue;
 
-      cnpy::NpyArray out_npy_array = read_npyarray(input_dir_path + "/ma_qidx_out.npy");
-      int* out_qidx_carray = reinterpret_cast<int*>(out_npy_array.data);
+         std::string path = input_dir_path + "/ma_qidx" + side_suffix(side) + ".npy";
+         npy_view npy(path);
+         // 32 and 64 bit indices are both accepted, whatever the Index of this build
+         npy.require('i', npy.word_size() == 8 ? 8 : 4, 0);
 
-      if (out_npy_array.shape[0] != madata.coords->size()) {
-         std::cerr << "Mismatched number of coords and outer q indices" << std::endl;
-         exit(1);
-      }
+         if (npy.shape()[0] != N) {
+            std::cerr << "Mismatched number of coords and " << side_name(side) << " q indices" << std::endl;
+            exit(1);
+         }
 
-      madata.ma_qidx.reserve(2 * madata.coords->size());
-
-      for (size_t i = 0; i < madata.coords->size(); i++)
-         madata.ma_qidx.push_back(in_qidx_carray[i]);
-      in_npy_array.destruct();
-
-      for (size_t i = 0; i < madata.coords->size(); i++)
-         madata.ma_qidx.push_back(out_qidx_carray[i]);
-      out_npy_array.destruct();
+         Index* out = &madata.ma_qidx[side == MA_INNER ? 0 : outer_offset];
+         if (npy.word_size() == 8)
+            read_indices<int64_t>(npy, path, out, N);
+         else
+            read_indices<int32_t>(npy, path, out, N);
+      }
    }
 
    if (params.lfs) {
       std::cout << "Reading lfs array..." << std::endl;
 
-      cnpy::NpyArray npy_array = read_npyarray(input_dir_path + "/lfs.npy");
-      float* lfs_carray = reinterpret_cast<float*>(npy_array.data);
+      npy_view npy(input_dir_path + "/lfs.npy");
+      npy.require('f', 4, 0);
 
-      if (npy_array.shape[0] != madata.coords->size()) {
+      if (npy.shape()[0] != N) {
          std::cerr << "Mismatched number of coords and lfs" << std::endl;
          exit(1);
       }
 
-      madata.lfs.reserve(madata.coords->size());
-
-      for (size_t i = 0; i < madata.coords->size(); i++)
-         madata.lfs.push_back(lfs_carray[i]);
-      npy_array.destruct();
+      madata.lfs.assign(npy.as<float>(), npy.as<float>() + N);
    }
 }
 
-void madata2npy(std::string npy_path, ma_data &madata, io_parameters &params) {
+void write_madata(array_output &output, ma_data &madata, io_parameters &params) {
+   // Every array is written by all threads straight into its output buffer
+   size_t N = madata.coords->size();
+
    if (params.coords) {
       std::cout << "Writing coords array..." << std::endl;
 
-      const unsigned int shape[] = { static_cast<unsigned int>(madata.coords->size()), 3 };
-      float* coords_carray = new float[madata.coords->size() * 3];
-      for (size_t i = 0; i < madata.coords->size(); i++) {
-         coords_carray[i * 3 + 0] = madata.coords->at(i).x;
-         coords_carray[i * 3 + 1] = madata.coords->at(i).y;
-         coords_carray[i * 3 + 2] = madata.coords->at(i).z;
+      float* coords_carray = output.open_as<float>("coords", 'f', N, 3);
+#pragma omp parallel for
+      for (Index i = 0; i < N; i++) {
+         const Point &pt = (*madata.coords)[i];
+         float* v = coords_carray + 3 * size_t(i);
+         v[0] = pt.x;
+         v[1] = pt.y;
+         v[2] = pt.z;
       }
-      cnpy::npy_save(npy_path + "/coords.npy", coords_carray, shape, 2, "w");
-      delete[] coords_carray; coords_carray = nullptr;
+      output.close();
    }
 
    if (params.normals) {
       std::cout << "Writing normals array..." << std::endl;
 
-      const unsigned int shape[] = { static_cast<unsigned int>(madata.coords->size()), 3 };
-      float* normals_carray = new float[madata.coords->size() * 3];
-      for (size_t i = 0; i < madata.coords->size(); i++) {
-         normals_carray[i * 3 + 0] = madata.normals->at(i).normal_x;
-         normals_carray[i * 3 + 1] = madata.normals->at(i).normal_y;
-         normals_carray[i * 3 + 2] = madata.normals->at(i).normal_z;
+      // Packed normals are written in their encoding, as a 1D unsigned array
+      const oct_normals &packed = madata.packed_normals;
+      if (packed.bits == 32)
+         write_array(output, "normals", 'u', &packed.oct32[0], N);
+      else if (packed.bits == 16)
+         write_array(output, "normals", 'u', &packed.oct16[0], N);
+      else {
+         float* normals_carray = output.open_as<float>("normals", 'f', N, 3);
+#pragma omp parallel for
+         for (Index i = 0; i < N; i++) {
+            const Normal &nm = (*madata.normals)[i];
+            float* v = normals_carray + 3 * size_t(i);
+            v[0] = nm.normal_x;
+            v[1] = nm.normal_y;
+            v[2] = nm.normal_z;
+         }
+         output.close();
       }
-      cnpy::npy_save(npy_path + "/normals.npy", normals_carray, shape, 2, "w");
-      delete[] normals_carray; normals_carray = nullptr;
    }
 
+   // With both sides the exterior balls are stored after the interior ones
+   size_t outer_offset = (madata.sides & MA_INNER) ? N : 0;
+
    if (params.ma_coords) {
       std::cout << "Writing ma coords arrays..." << std::endl;
 
-      const unsigned int shape[] = { static_cast<unsigned int>(madata.coords->size()), 3 };
+      for (int side = MA_INNER; side <= MA_OUTER; side++) {
+         if (!(madata.sides & side))
+            continue;
+         size_t offset = side == MA_INNER ? 0 : outer_offset;
 
-      float* in_ma_coords_carray = new float[madata.coords->size() * 3];
-      for (size_t i = 0; i < madata.coords->size(); i++) {
-         in_ma_coords_carray[i * 3 + 0] = madata.ma_coords->at(i).x;
-         in_ma_coords_carray[i * 3 + 1] = madata.ma_coords->at(i).y;
-         in_ma_coords_carray[i * 3 + 2] = madata.ma_coords->at(i).z;
-      }
-      cnpy::npy_save(npy_path + "/ma_coords_in.npy", in_ma_coords_carray, shape, 2, "w");
-      delete[] in_ma_coords_carray; in_ma_coords_carray = nullptr;
-
-      float* out_ma_coords_carray = new float[madata.coords->size() * 3];
-      for (size_t i = 0; i < madata.coords->size(); i++) {
-         out_ma_coords_carray[i * 3 + 0] = madata.ma_coords->at(i + madata.coords->size()).x;
-         out_ma_coords_carray[i * 3 + 1] = madata.ma_coords->at(i + madata.coords->size()).y;
-         out_ma_coords_carray[i * 3 + 2] = madata.ma_coords->at(i + madata.coords->size()).z;
+         float* ma_coords_carray = output.open_as<float>("ma_coords" + side_suffix(side), 'f', N, 3);
+#pragma omp parallel for
+         for (Index i = 0; i < N; i++) {
+            const Point &pt = (*madata.ma_coords)[i + offset];
+            float* v = ma_coords_carray + 3 * size_t(i);
+            v[0] = pt.x;
+            v[1] = pt.y;
+            v[2] = pt.z;
+         }
+         output.close();
       }
-      cnpy::npy_save(npy_path + "/ma_coords_out.npy", out_ma_coords_carray, shape, 2, "w");
-      delete[] out_ma_coords_carray; out_ma_coords_carray = nullptr;
    }
 
    if (params.ma_qidx) {
       std::cout << "Writing q index arrays..." << std::endl;
 
-      const unsigned int shape[] = { static_cast<unsigned int>(madata.coords->size()) };
-
-      cnpy::npy_save(npy_path + "/ma_qidx_in.npy", &madata.ma_qidx[0], shape, 1, "w");
-      cnpy::npy_save(npy_path + "/ma_qidx_out.npy", &madata.ma_qidx[madata.coords->size()], shape, 1, "w");
+      for (int side = MA_INNER; side <= MA_OUTER; side++)
+         if (madata.sides & side)
+            write_array(output, "ma_qidx" + side_suffix(side), 'i', &madata.ma_qidx[side == MA_INNER ? 0 : outer_offset], N);
    }
 
    if (params.ma_radius) {
-	   std::cout << "Writing ma radius arrays..." << std::endl;
-	   const unsigned int shape[] = { static_cast<unsigned int>(madata.coords->size()) };
+      std::cout << "Writing ma radius arrays..." << std::endl;
 
-	   cnpy::npy_save(npy_path + "/ma_radius_in.npy", &madata.ma_radius[0], shape, 1, "w");
-	   cnpy::npy_save(npy_path + "/ma_radius_out.npy", &madata.ma_radius[madata.coords->size()], shape, 1, "w");
+      for (int side = MA_INNER; side <= MA_OUTER; side++)
+         if (madata.sides & side)
+            write_array(output, "ma_radius" + side_suffix(side), 'f', &madata.ma_radius[side == MA_INNER ? 0 : outer_offset], N);
    }
 
-   
-
    if (params.lfs) {
       std::cout << "Writing lfs array..." << std::endl;
 
-      const unsigned int shape[] = { static_cast<unsigned int>(madata.coords->size()) };
-      cnpy::npy_save(npy_path + "/lfs.npy", &madata.lfs[0], shape, 1, "w");
+      write_array(output, "lfs", 'f', &madata.lfs[0], N);
    }
 
+   // Where coords and ma_coords are relative to, for points that were read in world coordinates
+   if (has_origin(madata) && (params.coords || params.ma_coords))
+      write_array(output, "origin", 'f', madata.origin, 3);
+
    if (params.mask) {
       std::cout << "Writing mask array..." << std::endl;
 
-      const unsigned int shape[] = { static_cast<unsigned int>(madata.coords->size()) };
-      bool* out_mask_carray = new bool[madata.coords->size()];
-      for (size_t i = 0; i < madata.coords->size(); i++) {
+      bool* out_mask_carray = output.open_as<bool>("decimate_lfs", 'b', N, 0);
+#pragma omp parallel for
+      for (Index i = 0; i < N; i++)
          out_mask_carray[i] = madata.mask[i];
+      output.close();
+   }
+}
+
+void madata2npy(std::string npy_path, ma_data &madata, io_parameters &params) {
+   npy_directory output(npy_path);
+   write_madata(output, madata, params);
+}
+
+void madata2npz(std::string npz_path, ma_data &madata, io_parameters &params) {
+   npz_archive output(npz_path);
+   write_madata(output, madata, params);
+}
+
+// Fields of a LAS public header block, see the ASPRS LAS 1.4 specification for the offsets
+const size_t las_header_size = 94;
+const size_t las_point_offset = 96;
+const size_t las_point_format = 104;
+const size_t las_record_length = 105;
+const size_t las_legacy_count = 107;
+const size_t las_legacy_count_by_return = 111;
+const size_t las_scale = 131;
+const size_t las_offset = 155;
+const size_t las_bounds = 179;    // max x, min x, max y, min y, max z, min z
+const size_t las_waveform = 227;  // 1.3 and up
+const size_t las_evlr = 235;      // 1.4
+const size_t las_count = 247;     // 1.4
+const size_t las_count_by_return = 255; // 1.4
+
+// Points that are read or filtered at once
+const size_t las_chunk = 1 << 20;
+
+inline void las_error(const std::string &message, const std::string &path) {
+   std::cerr << message << " " << path << std::endl;
+   exit(1);
+}
+
+template <class T>
+inline T las_get(const std::string &header, size_t offset) {
+   T v;
+   std::memcpy(&v, &header[offset], sizeof(T));
+   return v;
+}
+
+template <class T>
+inline void las_set(std::string &header, size_t offset, T v) {
+   std::memcpy(&header[offset], &v, sizeof(T));
+}
+
+// Reads the header block and the VLRs, everything before the point records. Exits with an error if the
+// file is not an uncompressed LAS 1.x file.
+std::string read_las_header(std::ifstream &in, const std::string &path) {
+   std::string header(las_point_format + 3, '\0');
+   in.read(&header[0], header.size());
+   if (!in || header.compare(0, 4, "LASF") != 0 || header[24] != 1)
+      las_error("Not a LAS 1.x file", path);
+   if (las_get<uint8_t>(header, las_point_format) & 0xc0)
+      las_error("Compressed (LAZ) point records are not supported in", path);
+   if ((las_get<uint8_t>(header, las_point_format) & 0x3f) > 10)
+      las_error("Unknown point data record format in", path);
+
+   // the public header block is 227 bytes up to LAS 1.2 and grows in later versions
+   header.resize(las_get<uint32_t>(header, las_point_offset));
+   if (header.size() < las_waveform || las_get<uint16_t>(header, las_header_size) < las_waveform || las_get<uint16_t>(header, las_header_size) > header.size())
+      las_error("Invalid LAS header in", path);
+   in.read(&header[las_point_format + 3], header.size() - (las_point_format + 3));
+   if (!in)
+      las_error("Truncated LAS header in", path);
+   return header;
+}
+
+// LAS 1.4 files may only fill in the 64 bit point count
+inline uint64_t las_point_count(const std::string &header) {
+   uint32_t legacy = las_get<uint32_t>(header, las_legacy_count);
+   if (header[25] >= 4 && las_get<uint16_t>(header, las_header_size) >= las_count_by_return)
+      return std::max<uint64_t>(legacy, las_get<uint64_t>(header, las_count));
+   return legacy;
+}
+
+void las2madata(std::string las_path, ma_data &madata) {
+   std::cout << "Reading LAS points..." << std::endl;
+
+   std::ifstream in(las_path.c_str(), std::ios::binary);
+   if (!in)
+      las_error("Invalid file path", las_path);
+   std::string header = read_las_header(in, las_path);
+
+   size_t N = size_t(las_point_count(header));
+   size_t record_length = las_get<uint16_t>(header, las_record_length);
+   if (record_length < 12)
+      las_error("Invalid point record length in", las_path);
+   if (2 * N > size_t(std::numeric_limits<Index>::max())) {
+      std::cerr << "Too many points for " << 8 * sizeof(Index) << " bit indices, rebuild with MASB_INDEX64" << std::endl;
+      exit(1);
+   }
+
+   quantized_cloud &quantized = madata.quantized;
+   quantized = quantized_cloud();
+   quantized.active = true;
+   for (int k = 0; k < 3; k++) {
+      quantized.scale[k] = las_get<double>(header, las_scale + 8 * k);
+      quantized.offset[k] = las_get<double>(header, las_offset + 8 * k);
+      if (!(quantized.scale[k] > 0))
+         las_error("Invalid scale in", las_path);
+      // The bounds in the header give the origin without a pass over the points, they're checked below
+      double bounds[2];
+      for (int b = 0; b < 2; b++) {
+         bounds[b] = (las_get<double>(header, las_bounds + 16 * k + 8 * b) - quantized.offset[k]) / quantized.scale[k];
+         if (!is_finite(Scalar(bounds[b])) || std::fabs(bounds[b]) > 2147483648.0)
+            bounds[b] = 0;
       }
-      cnpy::npy_save(npy_path + "/decimate_lfs.npy", out_mask_carray, shape, 1, "w");
-      delete[] out_mask_carray; out_mask_carray = nullptr;
+      quantized.origin[k] = (std::llround(bounds[0]) + std::llround(bounds[1])) / 2;
    }
+   madata.coords.reset(new PointCloud);
+   madata.coords->resize(N);
+
+   // The records are read one chunk at a time and their coordinates converted by all threads, while the
+   // integer bounding box of the points is collected in lo and hi
+   std::streampos first_record = in.tellg();
+   int64_t lo[3], hi[3];
+   auto read_points = [&]() {
+      in.clear();
+      in.seekg(first_record);
+      for (int k = 0; k < 3; k++) {
+         lo[k] = std::numeric_limits<int32_t>::max();
+         hi[k] = std::numeric_limits<int32_t>::min();
+      }
+      std::vector<char> chunk(std::min(N, las_chunk) * record_length + 1);
+      for (size_t first = 0; first < N; first += las_chunk) {
+         size_t count = std::min(las_chunk, N - first);
+         in.read(&chunk[0], count * record_length);
+         if (!in)
+            las_error("Unexpected end of point records in", las_path);
+#pragma omp parallel for
+         for (Index i = 0; i < count; i++) {
+            QPoint q;
+            std::memcpy(&q, &chunk[i * record_length], sizeof(QPoint));
+            (*madata.coords)[first + i] = Point(quantized.local(q.x, 0), quantized.local(q.y, 1), quantized.local(q.z, 2));
+         }
+         for (size_t i = 0; i < count; i++) {
+            QPoint q;
+            std::memcpy(&q, &chunk[i * record_length], sizeof(QPoint));
+            int64_t v[3] = { q.x, q.y, q.z };
+            for (int k = 0; k < 3; k++) {
+               lo[k] = std::min(lo[k], v[k]);
+               hi[k] = std::max(hi[k], v[k]);
+            }
+         }
+      }
+   };
+   read_points();
+
+   // Process the points relative to the center of their bounding box, where floats are most precise. If the
+   // header bounds were off, the points are read once more.
+   bool recenter = false;
+   for (int k = 0; k < 3 && N > 0; k++)
+      recenter = recenter || quantized.origin[k] != (lo[k] + hi[k]) / 2;
+   if (recenter) {
+      quantized.center(lo, hi);
+      read_points();
+   }
+   quantized.exact = N == 0 || quantized.covers(lo, hi);
+   for (int k = 0; k < 3; k++)
+      madata.origin[k] = quantized.world(quantized.origin[k], k);
+   std::cout << "Point count: " << N << ", coordinates relative to (" << madata.origin[0] << ", " << madata.origin[1] << ", " << madata.origin[2] << ")" << std::endl;
+   if (!quantized.exact)
+      std::cerr << "Warning: the points span more than 2^24 steps of the LAS scale, coordinates written in world units may be off by a step" << std::endl;
 }
 
-// Just a convenience function, to call when necessary.
-void convertNPYtoXYZ(std::string input_dir_path)
-{
-   // Read in the data:
-   cnpy::NpyArray coords_npy = read_npyarray(input_dir_path + "/coords.npy");
-   float* coords_carray = reinterpret_cast<float*>(coords_npy.data);
+void write_las_subset(std::string las_path, std::string out_path, const std::vector<bool> &mask) {
+   std::cout << "Writing LAS points..." << std::endl;
 
-   unsigned int num_points = coords_npy.shape[0];
-   unsigned int dim = coords_npy.shape[1];
+   std::ifstream in(las_path.c_str(), std::ios::binary);
+   if (!in)
+      las_error("Invalid file path", las_path);
+   std::string header = read_las_header(in, las_path);
 
-   // Write this out to a pointcloudxyz file:
-   std::string outFile(input_dir_path + "/coords.xyz");
-   std::ofstream out_pointcloudxyz(outFile);
-   if (!out_pointcloudxyz)
-   {
-      std::cerr << "Invalid file path " << outFile << std::endl;
+   uint64_t N = las_point_count(header);
+   size_t record_length = las_get<uint16_t>(header, las_record_length);
+   int format = las_get<uint8_t>(header, las_point_format) & 0x3f;
+   if (mask.size() != N)
+      las_error("Mismatched number of points and mask in", las_path);
+
+   std::ofstream out(out_path.c_str(), std::ios::binary | std::ios::trunc);
+   if (!out)
+      las_error("Could not create file", out_path);
+   out.write(header.data(), header.size());
+
+   // Copy the kept records, and keep track of the header fields that change
+   double scale[3], offset[3], lo[3], hi[3];
+   for (int k = 0; k < 3; k++) {
+      scale[k] = las_get<double>(header, las_scale + 8 * k);
+      offset[k] = las_get<double>(header, las_offset + 8 * k);
+      lo[k] = std::numeric_limits<double>::max();
+      hi[k] = -std::numeric_limits<double>::max();
+   }
+   uint64_t kept = 0, by_return[15] = {};
+   std::vector<char> chunk(size_t(std::min<uint64_t>(N, las_chunk)) * record_length + 1);
+   std::vector<char> selected(chunk.size());
+   for (uint64_t first = 0; first < N; first += las_chunk) {
+      size_t count = size_t(std::min<uint64_t>(las_chunk, N - first));
+      in.read(&chunk[0], count * record_length);
+      if (!in)
+         las_error("Unexpected end of point records in", las_path);
+
+      size_t n = 0;
+      for (size_t i = 0; i < count; i++) {
+         if (!mask[first + i])
+            continue;
+         const char *record = &chunk[i * record_length];
+         std::memcpy(&selected[n * record_length], record, record_length);
+         n++;
+
+         int32_t xyz[3];
+         std::memcpy(xyz, record, sizeof(xyz));
+         for (int k = 0; k < 3; k++) {
+            double v = xyz[k] * scale[k] + offset[k];
+            lo[k] = std::min(lo[k], v);
+            hi[k] = std::max(hi[k], v);
+         }
+         int return_number = uint8_t(record[14]) & (format < 6 ? 0x7 : 0xf);
+         if (return_number >= 1 && return_number <= 15)
+            by_return[return_number - 1]++;
+      }
+      out.write(&selected[0], n * record_length);
+      kept += n;
+   }
+
+   // Whatever follows the points (waveform data, EVLRs) moves up by the dropped records
+   uint64_t points_end = header.size() + N * record_length;
+   uint64_t removed = (N - kept) * record_length;
+   if (in.peek() != std::ifstream::traits_type::eof())
+      out << in.rdbuf();
+
+   if (kept == 0)
+      for (int k = 0; k < 3; k++)
+         lo[k] = hi[k] = 0;
+   for (int k = 0; k < 3; k++) {
+      las_set<double>(header, las_bounds + 16 * k, hi[k]);
+      las_set<double>(header, las_bounds + 16 * k + 8, lo[k]);
+   }
+   // The legacy counts stay 0 where they can't hold the numbers, as LAS 1.4 prescribes
+   bool legacy = format < 6 && kept <= std::numeric_limits<uint32_t>::max();
+   las_set<uint32_t>(header, las_legacy_count, legacy ? uint32_t(kept) : 0);
+   for (int r = 0; r < 5; r++)
+      las_set<uint32_t>(header, las_legacy_count_by_return + 4 * r, legacy ? uint32_t(by_return[r]) : 0);
+
+   uint16_t header_size = las_get<uint16_t>(header, las_header_size);
+   if (header[25] >= 3 && header_size >= las_evlr) {
+      uint64_t waveform = las_get<uint64_t>(header, las_waveform);
+      if (waveform >= points_end)
+         las_set<uint64_t>(header, las_waveform, waveform - removed);
+   }
+   if (header[25] >= 4 && header_size >= las_count_by_return + 15 * 8) {
+      uint64_t evlr = las_get<uint64_t>(header, las_evlr);
+      if (evlr >= points_end)
+         las_set<uint64_t>(header, las_evlr, evlr - removed);
+      las_set<uint64_t>(header, las_count, kept);
+      for (int r = 0; r < 15; r++)
+         las_set<uint64_t>(header, las_count_by_return + 8 * r, by_return[r]);
+   }
+   out.seekp(0);
+   out.write(header.data(), header_size);
+   out.close();
+   if (!out)
+      las_error("Could not write", out_path);
+
+   std::cout << kept << " of " << N << " points written to " << out_path << std::endl;
+}
+
+// Binary little endian PLY with the arrays as properties of one vertex element. madata2ply() writes
+// x y z, nx ny nz, ma_x_in ma_y_in ma_z_in ma_radius_in ma_qidx_in (and the same for _out), lfs, decimate_lfs
+enum ply_type { PLY_INT8, PLY_UINT8, PLY_INT16, PLY_UINT16, PLY_INT32, PLY_UINT32, PLY_FLOAT32, PLY_FLOAT64 };
+const char *ply_type_names[] = { "char", "uchar", "short", "ushort", "int", "uint", "float", "double" };
+const char *ply_type_aliases[] = { "int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+const size_t ply_type_sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+// PLY has no 64 bit integers, doubles hold indices exactly up to 2^53
+const ply_type ply_index_type = sizeof(Index) == 4 ? PLY_INT32 : PLY_FLOAT64;
+
+struct ply_property {
+   std::string name;
+   ply_type type;
+   size_t offset; // within the vertex record
+};
+
+struct ply_vertices {
+   size_t count, record_size;
+   const char *data; // first vertex record
+   std::vector<ply_property> properties;
+   bool has_origin;
+   double origin[3]; // from an "obj_info origin x y z" line
+};
+
+inline void ply_error(const std::string &message, const std::string &path) {
+   std::cerr << message << " " << path << std::endl;
+   exit(1);
+}
+
+template <class S>
+inline S ply_load(const char *v) {
+   S s;
+   std::memcpy(&s, v, sizeof(S));
+   return s;
+}
+
+// Value of property p of the vertex record, converted to T
+template <class T>
+inline T ply_get(const char *record, const ply_property &p) {
+   const char *v = record + p.offset;
+   switch (p.type) {
+   case PLY_INT8: return T(ply_load<int8_t>(v));
+   case PLY_UINT8: return T(ply_load<uint8_t>(v));
+   case PLY_INT16: return T(ply_load<int16_t>(v));
+   case PLY_UINT16: return T(ply_load<uint16_t>(v));
+   case PLY_INT32: return T(ply_load<int32_t>(v));
+   case PLY_UINT32: return T(ply_load<uint32_t>(v));
+   case PLY_FLOAT32: return T(ply_load<float>(v));
+   default: return T(ply_load<double>(v));
+   }
+}
+
+// Parses the header and locates the vertex records. Elements before the vertices are skipped, which
+// requires them to have a fixed size.
+ply_vertices read_ply_header(const file_view &file) {
+   const char *bytes = file.data(), *end = bytes + file.size();
+   const char *header_end = nullptr;
+   for (const char *p = bytes; p + 11 <= end && !header_end; p++)
+      if (std::memcmp(p, "end_header", 10) == 0 && (p[10] == '\n' || p[10] == '\r'))
+         header_end = p + (p[10] == '\r' ? 12 : 11);
+   if (file.size() < 4 || std::memcmp(bytes, "ply", 3) != 0 || !header_end)
+      ply_error("Invalid .ply file", file.path());
+
+   ply_vertices v = { 0, 0, nullptr, {}, false, { 0, 0, 0 } };
+   std::istringstream header(std::string(bytes, header_end));
+   std::string line;
+   size_t skip = 0, element_count = 0, element_size = 0;
+   bool in_vertex = false, past_vertex = false;
+   while (std::getline(header, line)) {
+      std::istringstream words(line);
+      std::string keyword;
+      words >> keyword;
+      if (keyword == "format") {
+         std::string format;
+         words >> format;
+         if (format != "binary_little_endian")
+            ply_error("Only binary little endian PLY is supported, not " + format + " in", file.path());
+      } else if (keyword == "obj_info") {
+         std::string key;
+         if (words >> key && key == "origin") {
+            words >> v.origin[0] >> v.origin[1] >> v.origin[2];
+            if (!words)
+               ply_error("Invalid obj_info origin in", file.path());
+            v.has_origin = true;
+         }
+      } else if (keyword == "element") {
+         // the records of the previous element come before the vertices
+         if (!in_vertex && !past_vertex)
+            skip += element_count * element_size;
+         past_vertex = past_vertex || in_vertex;
+         std::string element;
+         words >> element >> element_count;
+         element_size = 0;
+         in_vertex = element == "vertex" && !past_vertex;
+         if (in_vertex)
+            v.count = element_count;
+      } else if (keyword == "property") {
+         std::string type, name;
+         words >> type >> name;
+         if (type == "list") {
+            if (!past_vertex)
+               ply_error("PLY files with list properties before or in the vertices are not supported, in", file.path());
+            continue;
+         }
+         int t = 0;
+         while (t < 8 && type != ply_type_names[t] && type != ply_type_aliases[t])
+            t++;
+         if (t == 8)
+            ply_error("Unknown PLY property type " + type + " in", file.path());
+         if (in_vertex)
+            v.properties.push_back({ name, ply_type(t), element_size });
+         element_size += ply_type_sizes[t];
+      }
+   }
+   if (!in_vertex && !past_vertex)
+      ply_error("No vertex element in", file.path());
+
+   for (const ply_property &p : v.properties)
+      v.record_size = std::max(v.record_size, p.offset + ply_type_sizes[p.type]);
+   v.data = header_end + skip;
+   if (v.data > end || v.count * v.record_size > size_t(end - v.data))
+      ply_error("Truncated .ply file", file.path());
+   return v;
+}
+
+inline const ply_property *find_ply_property(const ply_vertices &v, const std::string &name) {
+   for (const ply_property &p : v.properties)
+      if (p.name == name)
+         return &p;
+   return nullptr;
+}
+
+inline const ply_property &require_ply_property(const ply_vertices &v, const std::string &name, const std::string &path) {
+   const ply_property *p = find_ply_property(v, name);
+   if (!p)
+      ply_error("Missing vertex property " + name + " in", path);
+   return *p;
+}
+
+// Calls set(i, x, y, z) with three float properties of every vertex i. Properties that are consecutive
+// floats, as madata2ply() writes them, are copied straight out of the mapped file.
+template <class Set>
+void read_ply_vectors(const ply_vertices &v, const std::string &path, const std::string names[3], Set set) {
+   const ply_property &px = require_ply_property(v, names[0], path);
+   const ply_property &py = require_ply_property(v, names[1], path);
+   const ply_property &pz = require_ply_property(v, names[2], path);
+   bool packed = px.type == PLY_FLOAT32 && py.type == PLY_FLOAT32 && pz.type == PLY_FLOAT32
+      && py.offset == px.offset + 4 && pz.offset == px.offset + 8;
+
+   if (packed) {
+#pragma omp parallel for
+      for (Index i = 0; i < v.count; i++) {
+         float xyz[3];
+         std::memcpy(xyz, v.data + i * v.record_size + px.offset, sizeof(xyz));
+         set(i, xyz[0], xyz[1], xyz[2]);
+      }
+   } else {
+#pragma omp parallel for
+      for (Index i = 0; i < v.count; i++) {
+         const char *record = v.data + i * v.record_size;
+         set(i, ply_get<float>(record, px), ply_get<float>(record, py), ply_get<float>(record, pz));
+      }
+   }
+}
+
+void ply2madata(std::string ply_path, ma_data &madata, io_parameters &params) {
+   file_view file(ply_path);
+   ply_vertices v = read_ply_header(file);
+   size_t N = v.count;
+   if (2 * N > size_t(std::numeric_limits<Index>::max())) {
+      std::cerr << "Too many points for " << 8 * sizeof(Index) << " bit indices, rebuild with MASB_INDEX64" << std::endl;
       exit(1);
    }
 
-   // Header
-   out_pointcloudxyz << "x y z\n";
+   if (params.coords) {
+      std::cout << "Reading coords..." << std::endl;
+
+      madata.coords.reset(new PointCloud);
+      madata.coords->resize(N);
+      const std::string names[3] = { "x", "y", "z" };
+      read_ply_vectors(v, ply_path, names, [&](Index i, float x, float y, float z) { (*madata.coords)[i] = Point(x, y, z); });
+   }
+   if (!madata.coords || madata.coords->size() != N)
+      ply_error("Mismatched number of coords and vertices in", ply_path);
+   if (v.has_origin)
+      std::copy(v.origin, v.origin + 3, madata.origin);
+
+   if (params.normals) {
+      std::cout << "Reading normals..." << std::endl;
+
+      const std::string names[3] = { "nx", "ny", "nz" };
+      oct_normals &packed = madata.packed_normals;
+      packed.clear();
+      packed.bits = params.normal_bits;
+      if (packed.bits == 32) {
+         madata.normals.reset();
+         packed.oct32.resize(N);
+         read_ply_vectors(v, ply_path, names, [&](Index i, float x, float y, float z) { packed.oct32[i] = oct_encode32(x, y, z); });
+      } else if (packed.bits == 16) {
+         madata.normals.reset();
+         packed.oct16.resize(N);
+         read_ply_vectors(v, ply_path, names, [&](Index i, float x, float y, float z) { packed.oct16[i] = oct_encode16(x, y, z); });
+      } else {
+         madata.normals.reset(new NormalCloud);
+         madata.normals->resize(N);
+         read_ply_vectors(v, ply_path, names, [&](Index i, float x, float y, float z) { (*madata.normals)[i] = Normal(x, y, z); });
+      }
+   }
+
+   if (params.ma_coords || params.ma_qidx) {
+      std::string probe = params.ma_coords ? "ma_x" : "ma_qidx";
+      int sides = params.sides;
+      if (!sides) {
+         sides = (find_ply_property(v, probe + "_in") ? MA_INNER : 0) | (find_ply_property(v, probe + "_out") ? MA_OUTER : 0);
+         // if there are none, reading the inner ones reports the error
+         sides = sides ? sides : MA_INNER;
+      }
+      madata.sides = ma_sides(sides);
+   }
+   size_t outer_offset = (madata.sides & MA_INNER) ? N : 0;
+
+   if (params.ma_coords) {
+      std::cout << "Reading ma coords..." << std::endl;
+
+      madata.ma_coords.reset(new PointCloud);
+      madata.ma_coords->resize(ma_size(madata));
+      for (int side = MA_INNER; side <= MA_OUTER; side++) {
+         if (!(madata.sides & side))
+            continue;
+         size_t offset = side == MA_INNER ? 0 : outer_offset;
+         const std::string names[3] = { "ma_x" + side_suffix(side), "ma_y" + side_suffix(side), "ma_z" + side_suffix(side) };
+         read_ply_vectors(v, ply_path, names, [&](Index i, float x, float y, float z) { (*madata.ma_coords)[i + offset] = Point(x, y, z); });
+      }
+   }
+
+   if (params.ma_qidx) {
+      std::cout << "Reading q indices..." << std::endl;
+
+      madata.ma_qidx.resize(ma_size(madata));
+      for (int side = MA_INNER; side <= MA_OUTER; side++) {
+         if (!(madata.sides & side))
+            continue;
+         size_t offset = side == MA_INNER ? 0 : outer_offset;
+         const ply_property &p = require_ply_property(v, "ma_qidx" + side_suffix(side), ply_path);
+#pragma omp parallel for
+         for (Index i = 0; i < N; i++)
+            madata.ma_qidx[i + offset] = Index(ply_get<double>(v.data + i * v.record_size, p));
+      }
+   }
+
+   if (params.lfs) {
+      std::cout << "Reading lfs..." << std::endl;
+
+      madata.lfs.resize(N);
+      const ply_property &p = require_ply_property(v, "lfs", ply_path);
+#pragma omp parallel for
+      for (Index i = 0; i < N; i++)
+         madata.lfs[i] = ply_get<float>(v.data + i * v.record_size, p);
+   }
+}
+
+void madata2ply(std::string ply_path, ma_data &madata, io_parameters &params) {
+   std::cout << "Writing " << ply_path << "..." << std::endl;
+
+   size_t N = madata.coords->size();
+   size_t outer_offset = (madata.sides & MA_INNER) ? N : 0;
+
+   // The vertex properties in record order
+   std::vector<ply_property> properties;
+   auto add = [&](const std::string &name, ply_type type) {
+      size_t offset = properties.empty() ? 0 : properties.back().offset + ply_type_sizes[properties.back().type];
+      properties.push_back({ name, type, offset });
+      return offset;
+   };
+   size_t coords = params.coords ? add("x", PLY_FLOAT32) : 0;
+   if (params.coords) {
+      add("y", PLY_FLOAT32);
+      add("z", PLY_FLOAT32);
+   }
+   size_t normals = params.normals ? add("nx", PLY_FLOAT32) : 0;
+   if (params.normals) {
+      add("ny", PLY_FLOAT32);
+      add("nz", PLY_FLOAT32);
+   }
+   size_t ma_coords[2] = {}, ma_radius[2] = {}, ma_qidx[2] = {};
+   for (int side = MA_INNER; side <= MA_OUTER; side++) {
+      if (!(madata.sides & side))
+         continue;
+      std::string suffix = side_suffix(side);
+      if (params.ma_coords) {
+         ma_coords[side - 1] = add("ma_x" + suffix, PLY_FLOAT32);
+         add("ma_y" + suffix, PLY_FLOAT32);
+         add("ma_z" + suffix, PLY_FLOAT32);
+      }
+      if (params.ma_radius)
+         ma_radius[side - 1] = add("ma_radius" + suffix, PLY_FLOAT32);
+      if (params.ma_qidx)
+         ma_qidx[side - 1] = add("ma_qidx" + suffix, ply_index_type);
+   }
+   size_t lfs = params.lfs ? add("lfs", PLY_FLOAT32) : 0;
+   size_t mask = params.mask ? add("decimate_lfs", PLY_UINT8) : 0;
+   size_t record_size = properties.empty() ? 0 : properties.back().offset + ply_type_sizes[properties.back().type];
+
+   std::string header = "ply\nformat binary_little_endian 1.0\ncomment written by masbcpp\n";
+   // Points read in world coordinates are written relative to their origin, which ply2madata() reads back
+   if (has_origin(madata)) {
+      std::ostringstream info;
+      info << std::setprecision(17) << "obj_info origin " << madata.origin[0] << " " << madata.origin[1] << " " << madata.origin[2] << "\n";
+      header += info.str();
+   }
+   header += "element vertex " + std::to_string(N) + "\n";
+   for (const ply_property &p : properties)
+      header += std::string("property ") + ply_type_names[p.type] + " " + p.name + "\n";
+   header += "end_header\n";
 
-   // coords
-   for (int i = 0; i < num_points; i++)
-   {
-      for (int j = 0; j < 3; j++)
-      {
-         if (j > 0) out_pointcloudxyz << " ";
-         out_pointcloudxyz << coords_carray[i * 3 + j];
+   // All threads fill the records in the mapped file
+   file_writer file(ply_path, header.size() + N * record_size);
+   std::memcpy(file.data(), header.data(), header.size());
+   char *records = file.data() + header.size();
+#pragma omp parallel for
+   for (Index i = 0; i < N; i++) {
+      char *record = records + i * record_size;
+      if (params.coords) {
+         const Point &pt = (*madata.coords)[i];
+         float v[3] = { pt.x, pt.y, pt.z };
+         std::memcpy(record + coords, v, sizeof(v));
       }
-      out_pointcloudxyz << "\n";
+      if (params.normals) {
+         Vector3 nm = point_normal(madata, i);
+         float v[3] = { nm[0], nm[1], nm[2] };
+         std::memcpy(record + normals, v, sizeof(v));
+      }
+      for (int side = MA_INNER; side <= MA_OUTER; side++) {
+         if (!(madata.sides & side))
+            continue;
+         size_t j = i + (side == MA_INNER ? 0 : outer_offset);
+         if (params.ma_coords) {
+            const Point &pt = (*madata.ma_coords)[j];
+            float v[3] = { pt.x, pt.y, pt.z };
+            std::memcpy(record + ma_coords[side - 1], v, sizeof(v));
+         }
+         if (params.ma_radius)
+            std::memcpy(record + ma_radius[side - 1], &madata.ma_radius[j], sizeof(float));
+         if (params.ma_qidx) {
+            if (ply_index_type == PLY_INT32) {
+               int32_t q = int32_t(madata.ma_qidx[j]);
+               std::memcpy(record + ma_qidx[side - 1], &q, sizeof(q));
+            } else {
+               double q = double(madata.ma_qidx[j]);
+               std::memcpy(record + ma_qidx[side - 1], &q, sizeof(q));
+            }
+         }
+      }
+      if (params.lfs)
+         std::memcpy(record + lfs, &madata.lfs[i], sizeof(float));
+      if (params.mask)
+         record[mask] = madata.mask[i] ? 1 : 0;
    }
-   coords_npy.destruct();
+}
+
+// Writes the tree to kdtree_<hash>.bin in dir, the input directory, the first time, and maps it from there after
+void attach_kdtree(std::string dir, ma_data &madata) {
+   uint64_t key = cloud_key(*madata.coords);
+   std::ostringstream name;
+   name << dir << "/kdtree_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+   std::string path = name.str();
+   std::replace(path.begin(), path.end(), '\\', '/');
+
+   madata.kd_tree.reset(new flat_kdtree());
+   if (madata.kd_tree->load(madata.coords, path, key)) {
+      std::cout << "Reading kd-tree from " << path << std::endl;
+      return;
+   }
+   madata.kd_tree->setInputCloud(madata.coords);
+   if (madata.kd_tree->save(path, key))
+      std::cout << "Wrote kd-tree to " << path << std::endl;
+   else
+      std::cerr << "Warning: could not write kd-tree to " << path << std::endl;
+}
+
+// Just a convenience function, to call when necessary.
+void convertNPYtoXYZ(std::string input_dir_path)
+{
+   // Read in the data:
+   npy_view coords_npy(input_dir_path + "/coords.npy");
+   coords_npy.require('f', 4, 3);
+   const float* coords_carray = coords_npy.as<float>();
+
+   size_t num_points = coords_npy.shape()[0];
+   PointCloud cloud;
+   cloud.resize(num_points);
+#pragma omp parallel for
+   for (Index i = 0; i < Index(num_points); i++)
+      cloud[i] = Point(coords_carray[i * 3], coords_carray[i * 3 + 1], coords_carray[i * 3 + 2]);
+
+   // Write this out to a pointcloudxyz file:
+   write_xyz(input_dir_path + "/coords.xyz", cloud);
 }
@@ -37,10 +37,33 @@ struct io_parameters {
    bool ma_radius;
    bool lfs;
    bool mask;
+   int sides;   // ma_sides to read, 0 reads the sides for which files exist
+   int normal_bits; // 16 or 32 reads float normals into madata.packed_normals with that many bits, 0 keeps them as floats
 };
 
 void npy2madata(std::string input_dir_path, ma_data &madata, io_parameters &p);
 void madata2npy(std::string npy_path, ma_data &madata, io_parameters &p);
+// Writes the same arrays as madata2npy() into one zip compressed archive, like numpy.savez_compressed
+void madata2npz(std::string npz_path, ma_data &madata, io_parameters &p);
+
+// Reads and writes the same arrays as npy2madata() and madata2npy() as vertex properties of one binary
+// little endian PLY file: x y z, nx ny nz, ma_x_in ma_y_in ma_z_in ma_radius_in ma_qidx_in (and _out), lfs, decimate_lfs.
+// Coordinates relative to madata.origin (see las2madata()) stay so, with the origin in an "obj_info origin x y z" line.
+void ply2madata(std::string ply_path, ma_data &madata, io_parameters &p);
+void madata2ply(std::string ply_path, ma_data &madata, io_parameters &p);
+
+// Streams the points of an uncompressed LAS 1.2-1.4 file into madata.coords, relative to madata.origin, the
+// center of their bounding box, so that georeferenced points keep their precision as floats. madata.quantized
+// receives the scale and offset of the LAS header, with which their integers can be recovered.
+void las2madata(std::string las_path, ma_data &madata);
+// Writes the points of las_path for which mask is set to out_path with all their attributes. The VLRs and
+// EVLRs are copied, the point counts and bounds in the header are updated.
+void write_las_subset(std::string las_path, std::string out_path, const std::vector<bool> &mask);
+
+// Sets madata.kd_tree to the tree over madata.coords that is cached in dir, as kdtree_<key>.bin with the
+// cloud_key() of the points, or builds that tree and writes it there for later runs. Call it after
+// morton_sort(), since the tree depends on the order of the points.
+void attach_kdtree(std::string dir, ma_data &madata);
 
 // Just a convenience function, to call when necessary.
 void convertNPYtoXYZ(std::string input_dir_path);
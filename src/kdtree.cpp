@@ -0,0 +1,938 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "kdtree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define KDTREE_SSE
+#endif
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+// A balanced tree over 2^64 points with one point per leaf is 64 levels deep,
+// and a traversal pushes at most one node per level.
+const unsigned int max_depth = 64;
+// Number of traversals nearest_batch() keeps in flight. Interleaving only pays off when the tree does not
+// fit in the cache and the queries are spread out, on coherent queries a single traversal is faster.
+#ifndef KDTREE_INTERLEAVE
+#define KDTREE_INTERLEAVE 8
+#endif
+const unsigned int batch_width = KDTREE_INTERLEAVE;
+// A batch counts as coherent, and is answered one query after the other, when along some axis its queries
+// span less than this fraction of the tree
+const Scalar coherent_batch_extent = Scalar(1) / 16;
+
+// Layout of a saved tree: this header, then the nodes, x, y, z and index arrays at the given offsets,
+// which are aligned so that the mapped arrays can be used in place
+struct kdtree_file_header {
+   char magic[8];
+   uint32_t index_size, scalar_size, node_size, leaf_size;
+   uint64_t key, points, nodes;
+   uint64_t nodes_offset, x_offset, y_offset, z_offset, index_offset;
+};
+const char kdtree_file_magic[8] = { 'M', 'A', 'S', 'B', 'K', 'D', 'T', '1' };
+const uint64_t kdtree_file_align = 64;
+
+// Trees over fewer points are built by one thread
+const size_t parallel_build_points = 1 << 16;
+
+// A node whose range is known but which is not built yet
+struct pending_node {
+   UIndex n, begin, end;
+};
+
+// Number of nodes in the trees over n and n + 1 points. Every node splits its range in the middle, so these only
+// depend on n, and the trees over the halves have n / 2 and n / 2 + 1 points as well.
+static std::pair<UIndex, UIndex> subtree_nodes(UIndex n, UIndex leaf_size) {
+   if (n < leaf_size)
+      return std::make_pair(UIndex(1), UIndex(1));
+   if (n == leaf_size)
+      return std::make_pair(UIndex(1), UIndex(3));
+   std::pair<UIndex, UIndex> half = subtree_nodes(n / 2, leaf_size);
+   if (n % 2 == 0)
+      return std::make_pair(1 + 2 * half.first, 1 + half.first + half.second);
+   return std::make_pair(1 + half.first + half.second, 1 + 2 * half.second);
+}
+
+static uint64_t align_offset(uint64_t offset) {
+   return (offset + kdtree_file_align - 1) / kdtree_file_align * kdtree_file_align;
+}
+
+flat_kdtree::flat_kdtree(unsigned int leaf_size)
+   : pcl::search::Search<Point>("flat_kdtree", true), leaf_size_(std::max(1u, leaf_size)) {
+}
+
+void flat_kdtree::setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices) {
+   pcl::search::Search<Point>::setInputCloud(cloud, indices);
+
+   std::vector<Index> order;
+   if (indices)
+      order.assign(indices->begin(), indices->end());
+   else {
+      order.resize(cloud->size());
+      for (size_t i = 0; i < order.size(); i++)
+         order[i] = Index(i);
+   }
+   build_tree(order);
+}
+
+void flat_kdtree::setInputCloud(const PointCloudConstPtr &cloud, const std::vector<Index> &indices) {
+   pcl::search::Search<Point>::setInputCloud(cloud);
+
+   std::vector<Index> order(indices);
+   build_tree(order);
+}
+
+void flat_kdtree::build_tree(std::vector<Index> &order) {
+   const PointCloud &cloud = *input_;
+   file_.reset();
+   node_store_.clear();
+   if (!order.empty()) {
+      node_store_.resize(subtree_nodes(UIndex(order.size()), leaf_size_).first);
+
+      int threads = 1;
+#ifdef WITH_OPENMP
+      threads = omp_get_max_threads();
+#endif
+      // Split the top of the tree one level at a time, the threads share the bounding boxes of the few large
+      // nodes and split the nodes of a level side by side. Once there are enough subtrees to balance the load,
+      // every thread builds whole subtrees. The nodes end up where the serial build puts them.
+      std::vector<pending_node> level(1, pending_node{ 0, 0, UIndex(order.size()) });
+      if (threads > 1 && order.size() >= parallel_build_points) {
+         while (!level.empty() && level.size() < 4 * size_t(threads)) {
+            for (size_t i = 0; i < level.size(); i++)
+               bound_node(level[i].n, level[i].begin, level[i].end, order, true);
+
+            std::vector<UIndex> mid(level.size());
+#pragma omp parallel for schedule(dynamic)
+            for (Index i = 0; i < level.size(); i++)
+               mid[i] = split_node(level[i].n, order);
+
+            std::vector<pending_node> next;
+            for (size_t i = 0; i < level.size(); i++) {
+               const pending_node &p = level[i];
+               if (mid[i] == p.end)
+                  continue;
+               next.push_back(pending_node{ p.n + 1, p.begin, mid[i] });
+               next.push_back(pending_node{ node_store_[p.n].right, mid[i], p.end });
+            }
+            level.swap(next);
+         }
+      }
+#pragma omp parallel for schedule(dynamic)
+      for (Index i = 0; i < level.size(); i++)
+         build(level[i].n, level[i].begin, level[i].end, order);
+   }
+
+   // copy the points into leaf order
+   index_store_.swap(order);
+   x_store_.resize(index_store_.size());
+   y_store_.resize(index_store_.size());
+   z_store_.resize(index_store_.size());
+#pragma omp parallel for
+   for (Index i = 0; i < index_store_.size(); i++) {
+      const Point &pt = cloud[index_store_[i]];
+      x_store_[i] = pt.x;
+      y_store_[i] = pt.y;
+      z_store_[i] = pt.z;
+   }
+
+   nodes_.assign(node_store_);
+   x_.assign(x_store_);
+   y_.assign(y_store_);
+   z_.assign(z_store_);
+   index_.assign(index_store_);
+}
+
+bool flat_kdtree::save(const std::string &path, uint64_t key) const {
+   kdtree_file_header h = {};
+   std::memcpy(h.magic, kdtree_file_magic, sizeof(h.magic));
+   h.index_size = sizeof(Index);
+   h.scalar_size = sizeof(Scalar);
+   h.node_size = sizeof(node);
+   h.leaf_size = leaf_size_;
+   h.key = key;
+   h.points = index_.size();
+   h.nodes = nodes_.size();
+   h.nodes_offset = align_offset(sizeof(h));
+   h.x_offset = align_offset(h.nodes_offset + h.nodes * sizeof(node));
+   h.y_offset = align_offset(h.x_offset + h.points * sizeof(Scalar));
+   h.z_offset = align_offset(h.y_offset + h.points * sizeof(Scalar));
+   h.index_offset = align_offset(h.z_offset + h.points * sizeof(Scalar));
+
+   // write to a temporary file and rename it, so that a concurrent load never sees a partial tree
+   std::string tmp_path = path + ".tmp";
+   {
+      std::ofstream out(tmp_path.c_str(), std::ios::binary);
+      if (!out)
+         return false;
+      uint64_t pos = 0;
+      const char zeros[kdtree_file_align] = {};
+      auto put = [&](uint64_t offset, const void *data, uint64_t size) {
+         out.write(zeros, std::streamsize(offset - pos));
+         if (size)
+            out.write(static_cast<const char *>(data), std::streamsize(size));
+         pos = offset + size;
+      };
+      put(0, &h, sizeof(h));
+      put(h.nodes_offset, nodes_.data, h.nodes * sizeof(node));
+      put(h.x_offset, x_.data, h.points * sizeof(Scalar));
+      put(h.y_offset, y_.data, h.points * sizeof(Scalar));
+      put(h.z_offset, z_.data, h.points * sizeof(Scalar));
+      put(h.index_offset, index_.data, h.points * sizeof(Index));
+      if (!out.flush()) {
+         out.close();
+         std::remove(tmp_path.c_str());
+         return false;
+      }
+   }
+   std::remove(path.c_str());
+   if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+      std::remove(tmp_path.c_str());
+      return false;
+   }
+   return true;
+}
+
+bool flat_kdtree::load(const PointCloudConstPtr &cloud, const std::string &path, uint64_t key) {
+   // file_view exits on a missing or empty file, a missing cache is not an error here
+   std::ifstream in(path.c_str(), std::ios::binary | std::ios::ate);
+   if (!in || uint64_t(in.tellg()) < sizeof(kdtree_file_header))
+      return false;
+   in.close();
+   // the traversals jump around the nodes and keep coming back to the top of the tree
+   std::unique_ptr<file_view> file(new file_view(path, FILE_RANDOM));
+
+   kdtree_file_header h;
+   if (file->size() < sizeof(h))
+      return false;
+   std::memcpy(&h, file->data(), sizeof(h));
+   if (std::memcmp(h.magic, kdtree_file_magic, sizeof(h.magic)) != 0 || h.index_size != sizeof(Index) ||
+      h.scalar_size != sizeof(Scalar) || h.node_size != sizeof(node) || h.leaf_size != leaf_size_ ||
+      h.key != key || h.points != cloud->size())
+      return false;
+
+   // every section has to lie within the file, and the nodes are as many as the tree over these points has
+   uint64_t expected_nodes = h.points ? subtree_nodes(UIndex(h.points), leaf_size_).first : 0;
+   auto fits = [&file](uint64_t offset, uint64_t bytes) {
+      return offset % kdtree_file_align == 0 && offset >= sizeof(kdtree_file_header) &&
+         offset <= file->size() && bytes <= file->size() - offset;
+   };
+   if (h.nodes != expected_nodes || !fits(h.nodes_offset, h.nodes * sizeof(node)) ||
+      !fits(h.x_offset, h.points * sizeof(Scalar)) || !fits(h.y_offset, h.points * sizeof(Scalar)) ||
+      !fits(h.z_offset, h.points * sizeof(Scalar)) || !fits(h.index_offset, h.points * sizeof(Index)))
+      return false;
+
+   // The traversals keep at most one node per level on their stack
+   unsigned int depth = 1;
+   for (uint64_t n = h.points; n > leaf_size_; n -= n / 2)
+      depth++;
+   if (depth > max_depth)
+      return false;
+
+   // A damaged file must not send the traversals out of the arrays or around in circles. The shape of the
+   // tree follows from the number of points, so every node has to be where build() puts it: a leaf once
+   // there are at most leaf_size_ points, otherwise split in halves with the children at n + 1 and right.
+   const char *base = file->data();
+   const node *nodes = reinterpret_cast<const node *>(base + h.nodes_offset);
+   const Index *index = reinterpret_cast<const Index *>(base + h.index_offset);
+   bool valid = h.nodes == 0 || (nodes[0].begin == 0 && nodes[0].end == h.points);
+#pragma omp parallel for reduction(&&:valid)
+   for (Index i = 0; i < Index(h.nodes); i++) {
+      const node &nd = nodes[i];
+      bool ok = nd.begin <= nd.end && nd.end <= h.points;
+      if (ok && nd.end - nd.begin <= leaf_size_)
+         ok = nd.right == 0;
+      else if (ok) {
+         UIndex mid = nd.begin + (nd.end - nd.begin) / 2;
+         uint64_t right = uint64_t(i) + 1 + subtree_nodes(mid - nd.begin, leaf_size_).first;
+         ok = nd.right == right && right < h.nodes &&
+            nodes[i + 1].begin == nd.begin && nodes[i + 1].end == mid &&
+            nodes[right].begin == mid && nodes[right].end == nd.end;
+      }
+      valid = valid && ok;
+   }
+#pragma omp parallel for reduction(&&:valid)
+   for (Index i = 0; i < Index(h.points); i++)
+      valid = valid && index[i] >= 0 && uint64_t(index[i]) < h.points;
+   if (!valid)
+      return false;
+
+   pcl::search::Search<Point>::setInputCloud(cloud);
+   node_store_.clear();
+   x_store_.clear();
+   y_store_.clear();
+   z_store_.clear();
+   index_store_.clear();
+
+   nodes_.data = nodes;
+   nodes_.count = size_t(h.nodes);
+   x_.data = reinterpret_cast<const Scalar *>(base + h.x_offset);
+   y_.data = reinterpret_cast<const Scalar *>(base + h.y_offset);
+   z_.data = reinterpret_cast<const Scalar *>(base + h.z_offset);
+   index_.data = index;
+   x_.count = y_.count = z_.count = index_.count = size_t(h.points);
+   file_ = std::move(file);
+   return true;
+}
+
+uint64_t cloud_key(const PointCloud &cloud) {
+   // hash fixed size chunks in parallel and combine the chunk hashes in order, so the key does not
+   // depend on the number of threads
+   const size_t chunk = 1 << 16;
+   const Index chunks = Index((cloud.size() + chunk - 1) / chunk);
+   std::vector<uint64_t> chunk_keys(chunks);
+
+   auto mix = [](uint64_t h, uint64_t v) {
+      // splitmix64 finalizer over the running state
+      h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+      h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+      h ^= h >> 27; h *= 0x94d049bb133111ebull;
+      h ^= h >> 31;
+      return h;
+   };
+
+#pragma omp parallel for
+   for (Index c = 0; c < chunks; c++) {
+      uint64_t h = uint64_t(c);
+      size_t end = std::min(cloud.size(), (size_t(c) + 1) * chunk);
+      for (size_t i = size_t(c) * chunk; i < end; i++) {
+         uint32_t b[3];
+         std::memcpy(&b[0], &cloud[i].x, 4);
+         std::memcpy(&b[1], &cloud[i].y, 4);
+         std::memcpy(&b[2], &cloud[i].z, 4);
+         h = mix(h, (uint64_t(b[0]) << 32) | b[1]);
+         h = mix(h, b[2]);
+      }
+      chunk_keys[c] = h;
+   }
+
+   uint64_t key = mix(0, cloud.size());
+   for (Index c = 0; c < chunks; c++)
+      key = mix(key, chunk_keys[c]);
+   return key;
+}
+
+void flat_kdtree::build(UIndex n, UIndex begin, UIndex end, std::vector<Index> &order) {
+   bound_node(n, begin, end, order, false);
+   UIndex mid = split_node(n, order);
+   if (mid != end) {
+      build(n + 1, begin, mid, order);
+      build(node_store_[n].right, mid, end, order);
+   }
+}
+
+void flat_kdtree::bound_node(UIndex n, UIndex begin, UIndex end, const std::vector<Index> &order, bool parallel) {
+   const PointCloud &pts = *input_;
+   int slices = 1;
+#ifdef WITH_OPENMP
+   if (parallel && end - begin >= parallel_build_points)
+      slices = omp_get_max_threads();
+#endif
+
+   // every slice bounds its part of the range, the parts are combined in order
+   std::vector<node> parts(slices);
+#pragma omp parallel for if(slices > 1)
+   for (int s = 0; s < slices; s++) {
+      node &part = parts[s];
+      for (int k = 0; k < 3; k++) {
+         part.lo[k] = std::numeric_limits<Scalar>::max();
+         part.hi[k] = -std::numeric_limits<Scalar>::max();
+      }
+      UIndex part_end = begin + UIndex(uint64_t(end - begin) * (s + 1) / slices);
+      for (UIndex i = begin + UIndex(uint64_t(end - begin) * s / slices); i < part_end; i++) {
+         const Point &pt = pts[order[i]];
+         part.lo[0] = std::min(part.lo[0], pt.x); part.hi[0] = std::max(part.hi[0], pt.x);
+         part.lo[1] = std::min(part.lo[1], pt.y); part.hi[1] = std::max(part.hi[1], pt.y);
+         part.lo[2] = std::min(part.lo[2], pt.z); part.hi[2] = std::max(part.hi[2], pt.z);
+      }
+   }
+
+   node &nd = node_store_[n];
+   nd = parts[0];
+   for (int s = 1; s < slices; s++) {
+      for (int k = 0; k < 3; k++) {
+         nd.lo[k] = std::min(nd.lo[k], parts[s].lo[k]);
+         nd.hi[k] = std::max(nd.hi[k], parts[s].hi[k]);
+      }
+   }
+   nd.begin = begin;
+   nd.end = end;
+   nd.right = 0;
+}
+
+UIndex flat_kdtree::split_node(UIndex n, std::vector<Index> &order) {
+   const PointCloud &pts = *input_;
+   node &nd = node_store_[n];
+   if (nd.end - nd.begin <= leaf_size_)
+      return nd.end;
+
+   // split at the median of the widest dimension
+   int dim = 0;
+   for (int k = 1; k < 3; k++)
+      if (nd.hi[k] - nd.lo[k] > nd.hi[dim] - nd.lo[dim])
+         dim = k;
+
+   UIndex mid = nd.begin + (nd.end - nd.begin) / 2;
+   std::nth_element(order.begin() + nd.begin, order.begin() + mid, order.begin() + nd.end,
+      [&pts, dim](Index a, Index b) { return pts[a].data[dim] < pts[b].data[dim]; });
+
+   // the left subtree follows the node, the right one follows the left one
+   nd.right = n + 1 + subtree_nodes(mid - nd.begin, leaf_size_).first;
+   return mid;
+}
+
+inline Scalar flat_kdtree::box_sqr_dist(const node &nd, const Vector3 &query) const {
+   Scalar d = 0;
+   for (int k = 0; k < 3; k++) {
+      Scalar e = std::max(Scalar(0), std::max(nd.lo[k] - query[k], query[k] - nd.hi[k]));
+      d += e * e;
+   }
+   return d;
+}
+
+// Scans one leaf bucket for a point closer than best_d, updates best and best_d
+inline void scan_leaf(const Scalar *x, const Scalar *y, const Scalar *z, UIndex begin, UIndex end,
+                      const Vector3 &query, UIndex &best, Scalar &best_d) {
+   UIndex i = begin;
+#ifdef KDTREE_SSE
+   const __m128 qx = _mm_set1_ps(query[0]), qy = _mm_set1_ps(query[1]), qz = _mm_set1_ps(query[2]);
+   for (; i + 4 <= end; i += 4) {
+      __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), qx);
+      __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), qy);
+      __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), qz);
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+      if (_mm_movemask_ps(_mm_cmplt_ps(d, _mm_set1_ps(best_d)))) {
+         float ds[4];
+         _mm_storeu_ps(ds, d);
+         for (int j = 0; j < 4; j++)
+            if (ds[j] < best_d) {
+               best_d = ds[j];
+               best = i + j;
+            }
+      }
+   }
+#endif
+   for (; i < end; i++) {
+      Scalar dx = x[i] - query[0], dy = y[i] - query[1], dz = z[i] - query[2];
+      Scalar d = dx * dx + dy * dy + dz * dz;
+      if (d < best_d) {
+         best_d = d;
+         best = i;
+      }
+   }
+}
+
+inline void prefetch(const void *p) {
+#ifdef KDTREE_SSE
+   _mm_prefetch((const char *)p, _MM_HINT_T0);
+#endif
+}
+
+inline void flat_kdtree::prefetch_node(UIndex n) const {
+   // Requests what a visit of node n reads: the boxes of its children, or its points
+   const node &nd = nodes_[n];
+   if (nd.right == 0) {
+      prefetch(&x_[nd.begin]);
+      prefetch(&y_[nd.begin]);
+      prefetch(&z_[nd.begin]);
+   } else {
+      prefetch(&nodes_[n + 1]);
+      prefetch(&nodes_[nd.right]);
+   }
+}
+
+Index flat_kdtree::nearest(const Vector3 &query, Scalar &sqr_dist, Scalar max_sqr_dist) const {
+   if (nodes_.empty())
+      return -1;
+
+   struct entry { UIndex n; Scalar d; } stack[max_depth];
+   unsigned int sp = 0;
+   UIndex best = (UIndex)-1;
+   Scalar best_d = max_sqr_dist;
+
+   UIndex n = 0;
+   if (box_sqr_dist(nodes_[0], query) >= best_d)
+      return -1;
+
+   while (true) {
+      const node &nd = nodes_[n];
+      if (nd.right == 0) {
+         scan_leaf(&x_[0], &y_[0], &z_[0], nd.begin, nd.end, query, best, best_d);
+      } else {
+         // descend into the closest child first, remember the other one
+         UIndex l = n + 1, r = nd.right;
+         Scalar dl = box_sqr_dist(nodes_[l], query), dr = box_sqr_dist(nodes_[r], query);
+         if (dr < dl) {
+            std::swap(l, r);
+            std::swap(dl, dr);
+         }
+         if (dr < best_d)
+            stack[sp++] = { r, dr };
+         if (dl < best_d) {
+            n = l;
+            continue;
+         }
+      }
+
+      // pop the next subtree that may still hold a closer point
+      while (sp > 0 && stack[sp - 1].d >= best_d)
+         sp--;
+      if (sp == 0)
+         break;
+      n = stack[--sp].n;
+   }
+
+   if (best == (UIndex)-1)
+      return -1;
+   sqr_dist = best_d;
+   return index_[best];
+}
+
+void flat_kdtree::nearest_batch(nn_query *queries, size_t count) const {
+   // Consecutive queries close together, like the sorted ones of our callers, follow nearly the same path
+   // through the tree. That path stays in the cache and its branches are predicted well, which interleaving
+   // would only break up.
+   bool coherent = batch_width < 2 || count < 2 || nodes_.empty();
+   if (!coherent) {
+      Vector3 lo = queries[0].point, hi = queries[0].point;
+      for (size_t i = 1; i < count; i++) {
+         lo = lo.cwiseMin(queries[i].point);
+         hi = hi.cwiseMax(queries[i].point);
+      }
+      for (int d = 0; d < 3; d++)
+         if (hi[d] - lo[d] < (nodes_[0].hi[d] - nodes_[0].lo[d]) * coherent_batch_extent)
+            coherent = true;
+   }
+   if (coherent) {
+      for (size_t i = 0; i < count; i++)
+         queries[i].index = nearest(queries[i].point, queries[i].sqr_dist, queries[i].max_sqr_dist);
+      return;
+   }
+
+   // The traversal of nearest(), cut into steps of one node each
+   struct traversal {
+      nn_query *query;
+      Vector3 point;
+      UIndex n, sp, best;
+      Scalar best_d;
+      struct entry { UIndex n; Scalar d; } stack[max_depth];
+   } slots[batch_width];
+   bool busy[batch_width];
+   unsigned int in_flight = 0;
+   // Every slot works through its own contiguous share of the queries
+   size_t next[batch_width], last[batch_width];
+   for (unsigned int s = 0; s < batch_width; s++) {
+      next[s] = count * s / batch_width;
+      last[s] = count * (s + 1) / batch_width;
+   }
+
+   // Puts the next query that needs a traversal in slot s, returns false when there are none left
+   auto start = [&](unsigned int s) {
+      while (next[s] < last[s]) {
+         nn_query &q = queries[next[s]++];
+         q.index = -1;
+         if (nodes_.empty() || box_sqr_dist(nodes_[0], q.point) >= q.max_sqr_dist)
+            continue;
+         traversal &t = slots[s];
+         t.query = &q;
+         t.point = q.point;
+         t.n = 0;
+         t.sp = 0;
+         t.best = (UIndex)-1;
+         t.best_d = q.max_sqr_dist;
+         return true;
+      }
+      return false;
+   };
+
+   // Visits the current node of t, returns false when the traversal is done
+   auto step = [&](traversal &t) {
+      const node &nd = nodes_[t.n];
+      if (nd.right == 0) {
+         scan_leaf(&x_[0], &y_[0], &z_[0], nd.begin, nd.end, t.point, t.best, t.best_d);
+      } else {
+         UIndex l = t.n + 1, r = nd.right;
+         Scalar dl = box_sqr_dist(nodes_[l], t.point), dr = box_sqr_dist(nodes_[r], t.point);
+         if (dr < dl) {
+            std::swap(l, r);
+            std::swap(dl, dr);
+         }
+         if (dr < t.best_d)
+            t.stack[t.sp++] = { r, dr };
+         if (dl < t.best_d) {
+            t.n = l;
+            prefetch_node(l);
+            return true;
+         }
+      }
+
+      while (t.sp > 0 && t.stack[t.sp - 1].d >= t.best_d)
+         t.sp--;
+      if (t.sp == 0)
+         return false;
+      t.n = t.stack[--t.sp].n;
+      prefetch_node(t.n);
+      return true;
+   };
+
+   for (unsigned int s = 0; s < batch_width; s++) {
+      busy[s] = start(s);
+      if (busy[s])
+         in_flight++;
+   }
+
+   while (in_flight > 0) {
+      for (unsigned int s = 0; s < batch_width; s++) {
+         if (!busy[s] || step(slots[s]))
+            continue;
+
+         traversal &t = slots[s];
+         if (t.best != (UIndex)-1) {
+            t.query->index = index_[t.best];
+            t.query->sqr_dist = t.best_d;
+         }
+         busy[s] = start(s);
+         if (!busy[s])
+            in_flight--;
+      }
+   }
+}
+
+bool flat_kdtree::points_in_ball(const Vector3 &center, Scalar sqr_radius, size_t max_count, point_list &points) const {
+   points.clear();
+   if (nodes_.empty())
+      return true;
+
+   UIndex stack[max_depth];
+   unsigned int sp = 0;
+   stack[sp++] = 0;
+   while (sp > 0) {
+      UIndex i = stack[--sp];
+      const node &nd = nodes_[i];
+      if (box_sqr_dist(nd, center) >= sqr_radius)
+         continue;
+      if (nd.right != 0) {
+         stack[sp++] = nd.right;
+         stack[sp++] = i + 1;
+         continue;
+      }
+      for (UIndex j = nd.begin; j < nd.end; j++) {
+         Scalar dx = x_[j] - center[0], dy = y_[j] - center[1], dz = z_[j] - center[2];
+         if (dx * dx + dy * dy + dz * dz < sqr_radius) {
+            if (points.size() == max_count)
+               return false;
+            points.push_back(index_[j], x_[j], y_[j], z_[j]);
+         }
+      }
+   }
+   return true;
+}
+
+void flat_kdtree::point_list::clear() {
+   index.clear();
+   x.clear();
+   y.clear();
+   z.clear();
+}
+
+void flat_kdtree::point_list::push_back(Index i, Scalar px, Scalar py, Scalar pz) {
+   index.push_back(i);
+   x.push_back(px);
+   y.push_back(py);
+   z.push_back(pz);
+}
+
+int flat_kdtree::point_list::nearest(const Vector3 &query, Scalar &sqr_dist, Scalar max_sqr_dist, Scalar keep_sqr_dist) {
+   unsigned int best = (unsigned int)-1;
+   Scalar best_d = max_sqr_dist;
+   size_t n = size(), kept = 0, i = 0;
+
+#ifdef KDTREE_SSE
+   const __m128 qx = _mm_set1_ps(query[0]), qy = _mm_set1_ps(query[1]), qz = _mm_set1_ps(query[2]);
+   const __m128 keep = _mm_set1_ps(keep_sqr_dist);
+   for (; i + 4 <= n; i += 4) {
+      __m128 dx = _mm_sub_ps(_mm_loadu_ps(&x[i]), qx);
+      __m128 dy = _mm_sub_ps(_mm_loadu_ps(&y[i]), qy);
+      __m128 dz = _mm_sub_ps(_mm_loadu_ps(&z[i]), qz);
+      __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+      int keep_mask = _mm_movemask_ps(_mm_cmplt_ps(d, keep));
+      if (keep_mask == 0)
+         continue;
+
+      float ds[4];
+      _mm_storeu_ps(ds, d);
+      if (keep_mask == 0xF && kept == i) {
+         // nothing dropped so far, no need to move points around
+         for (int j = 0; j < 4; j++)
+            if (ds[j] < best_d) {
+               best_d = ds[j];
+               best = (unsigned int)(i + j);
+            }
+         kept += 4;
+         continue;
+      }
+      for (int j = 0; j < 4; j++) {
+         if (!(keep_mask & (1 << j)))
+            continue;
+         if (ds[j] < best_d) {
+            best_d = ds[j];
+            best = (unsigned int)kept;
+         }
+         index[kept] = index[i + j]; x[kept] = x[i + j]; y[kept] = y[i + j]; z[kept] = z[i + j];
+         kept++;
+      }
+   }
+#endif
+   for (; i < n; i++) {
+      Scalar dx = x[i] - query[0], dy = y[i] - query[1], dz = z[i] - query[2];
+      Scalar d = dx * dx + dy * dy + dz * dz;
+      if (!(d < keep_sqr_dist))
+         continue;
+      if (d < best_d) {
+         best_d = d;
+         best = (unsigned int)kept;
+      }
+      index[kept] = index[i]; x[kept] = x[i]; y[kept] = y[i]; z[kept] = z[i];
+      kept++;
+   }
+
+   index.resize(kept);
+   x.resize(kept);
+   y.resize(kept);
+   z.resize(kept);
+
+   if (best == (unsigned int)-1)
+      return -1;
+   sqr_dist = best_d;
+   return int(best);
+}
+
+inline Scalar flat_kdtree::box_tangent_bound(const node &nd, const Vector3 &p, const Vector3 &n) const {
+   // Lower bound on the radius of a ball tangent to p with normal n through any point of the box.
+   // With v = p-q the radius is |v|^2 / (2 n.v), so we combine the smallest |v| with the largest n.v
+   // (which also never exceeds |v|). Returns the max Scalar if no point in the box is on the right side.
+   Scalar h = 0;
+   for (int k = 0; k < 3; k++)
+      h += n[k] * (p[k] - (n[k] > 0 ? nd.lo[k] : nd.hi[k]));
+   if (h <= 0)
+      return std::numeric_limits<Scalar>::max();
+
+   Scalar d2 = box_sqr_dist(nd, p);
+   Scalar d = std::sqrt(d2);
+   return d2 / (2 * std::min(h, d == 0 ? h : d));
+}
+
+Index flat_kdtree::min_tangent_ball(const Vector3 &p, const Vector3 &n, Scalar &radius) const {
+   if (nodes_.empty())
+      return -1;
+
+   struct entry { UIndex n; Scalar bound; } stack[max_depth];
+   unsigned int sp = 0;
+   UIndex best = (UIndex)-1;
+   Scalar best_r = radius;
+   Vector3 c = p - n * best_r;
+
+   // A node can only hold a better point if its box intersects the current ball,
+   // a point lies inside the ball exactly when its tangent radius is smaller.
+   auto reachable = [&](UIndex i, Scalar bound) {
+      return bound < best_r && box_sqr_dist(nodes_[i], c) < best_r * best_r;
+   };
+
+   UIndex i = 0;
+   if (!reachable(0, box_tangent_bound(nodes_[0], p, n)))
+      return -1;
+
+   while (true) {
+      const node &nd = nodes_[i];
+      if (nd.right == 0) {
+         for (UIndex j = nd.begin; j < nd.end; j++) {
+            Scalar vx = p[0] - x_[j], vy = p[1] - y_[j], vz = p[2] - z_[j];
+            Scalar h = n[0] * vx + n[1] * vy + n[2] * vz;
+            if (h <= 0)
+               continue;
+            Scalar r = (vx * vx + vy * vy + vz * vz) / (2 * h);
+            if (r < best_r) {
+               best_r = r;
+               best = j;
+               c = p - n * best_r;
+            }
+         }
+      } else {
+         UIndex l = i + 1, r = nd.right;
+         Scalar bl = box_tangent_bound(nodes_[l], p, n), br = box_tangent_bound(nodes_[r], p, n);
+         if (br < bl) {
+            std::swap(l, r);
+            std::swap(bl, br);
+         }
+         if (reachable(r, br))
+            stack[sp++] = { r, br };
+         if (reachable(l, bl)) {
+            i = l;
+            continue;
+         }
+      }
+
+      while (sp > 0 && !reachable(stack[sp - 1].n, stack[sp - 1].bound))
+         sp--;
+      if (sp == 0)
+         break;
+      i = stack[--sp].n;
+   }
+
+   if (best == (UIndex)-1)
+      return -1;
+   radius = best_r;
+   return index_[best];
+}
+
+int flat_kdtree::nearest_k(const Vector3 &query, int k, Index *k_indices, Scalar *k_sqr_distances) const {
+   if (nodes_.empty() || k <= 0)
+      return 0;
+
+   // k_indices/k_sqr_distances are kept sorted, insertion is fine for the small k we use
+   int found = 0;
+   Scalar worst = std::numeric_limits<Scalar>::max();
+
+   struct entry { UIndex n; Scalar d; } stack[max_depth];
+   unsigned int sp = 0;
+   UIndex n = 0;
+
+   while (true) {
+      const node &nd = nodes_[n];
+      if (nd.right == 0) {
+         for (UIndex i = nd.begin; i < nd.end; i++) {
+            Scalar dx = x_[i] - query[0], dy = y_[i] - query[1], dz = z_[i] - query[2];
+            Scalar d = dx * dx + dy * dy + dz * dz;
+            if (found == k && d >= worst)
+               continue;
+            int j = found < k ? found++ : k - 1;
+            for (; j > 0 && k_sqr_distances[j - 1] > d; j--) {
+               k_sqr_distances[j] = k_sqr_distances[j - 1];
+               k_indices[j] = k_indices[j - 1];
+            }
+            k_sqr_distances[j] = d;
+            k_indices[j] = index_[i];
+            if (found == k)
+               worst = k_sqr_distances[k - 1];
+         }
+      } else {
+         UIndex l = n + 1, r = nd.right;
+         Scalar dl = box_sqr_dist(nodes_[l], query), dr = box_sqr_dist(nodes_[r], query);
+         if (dr < dl) {
+            std::swap(l, r);
+            std::swap(dl, dr);
+         }
+         if (dr < worst)
+            stack[sp++] = { r, dr };
+         if (dl < worst) {
+            n = l;
+            continue;
+         }
+      }
+
+      while (sp > 0 && stack[sp - 1].d >= worst)
+         sp--;
+      if (sp == 0)
+         break;
+      n = stack[--sp].n;
+   }
+   return found;
+}
+
+int flat_kdtree::nearestKSearch(const Point &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const {
+   k_indices.resize(std::max(k, 0));
+   k_sqr_distances.resize(std::max(k, 0));
+   if (k <= 0)
+      return 0;
+
+   Vector3 query(point.x, point.y, point.z);
+#ifdef MASB_INDEX64
+   // the PCL interface has int indices
+   std::vector<Index> indices(k);
+   int found = nearest_k(query, k, &indices[0], &k_sqr_distances[0]);
+   std::copy(indices.begin(), indices.begin() + found, k_indices.begin());
+#else
+   int found = nearest_k(query, k, &k_indices[0], &k_sqr_distances[0]);
+#endif
+   k_indices.resize(found);
+   k_sqr_distances.resize(found);
+   return found;
+}
+
+int flat_kdtree::radiusSearch(const Point &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn) const {
+   k_indices.clear();
+   k_sqr_distances.clear();
+   if (nodes_.empty())
+      return 0;
+
+   Vector3 query(point.x, point.y, point.z);
+   Scalar r2 = Scalar(radius * radius);
+
+   UIndex stack[max_depth];
+   unsigned int sp = 0;
+   stack[sp++] = 0;
+   while (sp > 0) {
+      const node &nd = nodes_[stack[--sp]];
+      if (box_sqr_dist(nd, query) > r2)
+         continue;
+      if (nd.right != 0) {
+         stack[sp++] = nd.right;
+         stack[sp++] = (UIndex)(&nd - &nodes_[0]) + 1;
+         continue;
+      }
+      for (UIndex i = nd.begin; i < nd.end; i++) {
+         Scalar dx = x_[i] - query[0], dy = y_[i] - query[1], dz = z_[i] - query[2];
+         Scalar d = dx * dx + dy * dy + dz * dz;
+         if (d <= r2) {
+            k_indices.push_back(int(index_[i]));
+            k_sqr_distances.push_back(d);
+         }
+      }
+   }
+
+   if (sorted_results_ || (max_nn > 0 && k_indices.size() > max_nn)) {
+      std::vector<std::pair<Scalar, int> > sorted(k_indices.size());
+      for (size_t i = 0; i < sorted.size(); i++)
+         sorted[i] = std::make_pair(k_sqr_distances[i], k_indices[i]);
+      std::sort(sorted.begin(), sorted.end());
+      if (max_nn > 0 && sorted.size() > max_nn)
+         sorted.resize(max_nn);
+      k_indices.resize(sorted.size());
+      k_sqr_distances.resize(sorted.size());
+      for (size_t i = 0; i < sorted.size(); i++) {
+         k_sqr_distances[i] = sorted[i].first;
+         k_indices[i] = sorted[i].second;
+      }
+   }
+   return int(k_indices.size());
+}
@@ -0,0 +1,171 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_KDTREE_
+#define MASBCPP_KDTREE_
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <pcl/search/search.h>
+
+#include "types.h"
+#include "mapped_file.h"
+
+// The smart pointer template of P (boost::shared_ptr before PCL 1.11, std::shared_ptr since) applied to T
+template <class P, class T>
+struct rebind_ptr;
+template <template <class> class P, class U, class T>
+struct rebind_ptr<P<U>, T> {
+   typedef P<T> type;
+};
+
+// Immutable kd-tree tuned for the 1-NN queries of the shrinking ball algorithm.
+// Nodes live in one flat array in depth-first order (the left child of a node is
+// always the next node) and carry a tight bounding box of their points. The points
+// themselves are copied into leaf order as separate x/y/z arrays, so a leaf is a
+// contiguous bucket that is scanned with SIMD instructions.
+//
+// The tree implements the pcl::search::Search interface, so it can also be handed
+// to PCL algorithms such as the normal estimation.
+//
+// A built tree can be saved to a file that later runs map into memory with load(),
+// instead of building the same tree again.
+class flat_kdtree : public pcl::search::Search<Point> {
+public:
+   typedef rebind_ptr<pcl::search::Search<Point>::Ptr, flat_kdtree>::type Ptr;
+   typedef rebind_ptr<pcl::search::Search<Point>::Ptr, const flat_kdtree>::type ConstPtr;
+
+   struct node {
+      Scalar lo[3], hi[3];   // bounding box of the points below this node
+      UIndex begin, end; // range of the points below this node, in leaf order
+      UIndex right;      // index of the right child, 0 for leaves
+   };
+
+   // Points copied out of the tree in the same x/y/z layout as the leaves, see points_in_ball()
+   struct point_list {
+      std::vector<Index> index;
+      std::vector<Scalar> x, y, z;
+
+      size_t size() const { return index.size(); }
+      void clear();
+      void push_back(Index i, Scalar px, Scalar py, Scalar pz);
+
+      // Position in the list of the point closest to query that lies strictly within sqrt(max_sqr_dist),
+      // or -1. Also drops every point that is not strictly within sqrt(keep_sqr_dist) of query.
+      int nearest(const Vector3 &query, Scalar &sqr_dist, Scalar max_sqr_dist, Scalar keep_sqr_dist);
+   };
+
+   // A query of nearest_batch(), index and sqr_dist receive the result of nearest(point, sqr_dist, max_sqr_dist)
+   struct nn_query {
+      Vector3 point;
+      Scalar max_sqr_dist;
+      Index index;
+      Scalar sqr_dist;
+   };
+
+   explicit flat_kdtree(unsigned int leaf_size = 8);
+
+   // Builds the tree, the cloud should not be modified afterwards
+   void setInputCloud(const PointCloudConstPtr &cloud, const IndicesConstPtr &indices = IndicesConstPtr());
+   // Builds the tree over the given points of cloud only, unlike the PCL indices these may exceed the int range
+   void setInputCloud(const PointCloudConstPtr &cloud, const std::vector<Index> &indices);
+
+   // Index of the point closest to query that lies strictly within sqrt(max_sqr_dist),
+   // or -1 if there is no such point. Does not allocate.
+   Index nearest(const Vector3 &query, Scalar &sqr_dist, Scalar max_sqr_dist = std::numeric_limits<Scalar>::max()) const;
+
+   // Answers nearest() for each of the queries. Unless the queries lie close together, KDTREE_INTERLEAVE
+   // traversals are kept in flight and advanced one node at a time in turn, with the next node of each
+   // prefetched, so that a cache miss in one of them overlaps with work on the others. Does not allocate.
+   void nearest_batch(nn_query *queries, size_t count) const;
+
+   // Index of the point q that minimises the radius of the ball touching p and q whose center lies on
+   // p - n*r, ie. the final ball of the shrinking ball algorithm. Only points with a positive n.(p-q) and
+   // balls smaller than radius are considered, radius receives the result. Returns -1 if there is no such point.
+   Index min_tangent_ball(const Vector3 &p, const Vector3 &n, Scalar &radius) const;
+
+   // Collects the points strictly within sqrt(sqr_radius) of center. Gives up and returns false
+   // once more than max_count points are found.
+   bool points_in_ball(const Vector3 &center, Scalar sqr_radius, size_t max_count, point_list &points) const;
+
+   // k-NN search into caller provided arrays of size k, sorted by distance. Returns the number of neighbours found.
+   int nearest_k(const Vector3 &query, int k, Index *k_indices, Scalar *k_sqr_distances) const;
+
+   using pcl::search::Search<Point>::nearestKSearch;
+   using pcl::search::Search<Point>::radiusSearch;
+
+   int nearestKSearch(const Point &point, int k, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances) const;
+   int radiusSearch(const Point &point, double radius, std::vector<int> &k_indices, std::vector<float> &k_sqr_distances, unsigned int max_nn = 0) const;
+
+   // Writes the tree to path, along with key, which should identify the cloud (see cloud_key()). Returns false
+   // if the file can't be written.
+   bool save(const std::string &path, uint64_t key) const;
+   // Maps the tree that save() wrote to path, for cloud, instead of building it. Returns false, leaving the tree
+   // as is, if there is no such file or it was saved with another key, leaf size or number of points, or by a
+   // build with other index or scalar types.
+   bool load(const PointCloudConstPtr &cloud, const std::string &path, uint64_t key);
+
+   // The cloud this tree was built over
+   const PointCloud &cloud() const { return *input_; }
+   size_t size() const { return index_.size(); }
+
+private:
+   // Read-only view of an array, which is owned by the tree or lies in a mapped file
+   template <class T>
+   struct array_view {
+      const T *data = nullptr;
+      size_t count = 0;
+
+      const T &operator[](size_t i) const { return data[i]; }
+      size_t size() const { return count; }
+      bool empty() const { return count == 0; }
+      void assign(const std::vector<T> &v) { data = v.data(); count = v.size(); }
+   };
+
+   void build_tree(std::vector<Index> &order);
+   void build(UIndex n, UIndex begin, UIndex end, std::vector<Index> &order);
+   void bound_node(UIndex n, UIndex begin, UIndex end, const std::vector<Index> &order, bool parallel);
+   UIndex split_node(UIndex n, std::vector<Index> &order);
+   Scalar box_sqr_dist(const node &nd, const Vector3 &query) const;
+   Scalar box_tangent_bound(const node &nd, const Vector3 &p, const Vector3 &n) const;
+   void prefetch_node(UIndex n) const;
+
+   unsigned int leaf_size_;
+   array_view<node> nodes_;
+   array_view<Scalar> x_, y_, z_; // point coordinates in leaf order
+   array_view<Index> index_;      // index in the input cloud of every point in leaf order
+
+   // the arrays of a tree that was built, or the file of a tree that was loaded
+   std::vector<node> node_store_;
+   std::vector<Scalar> x_store_, y_store_, z_store_;
+   std::vector<Index> index_store_;
+   std::unique_ptr<file_view> file_;
+};
+
+// 64 bit hash of the point coordinates of cloud, in their order, to recognize the cloud of a saved tree
+uint64_t cloud_key(const PointCloud &cloud);
+
+#endif
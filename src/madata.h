@@ -26,18 +26,63 @@ SOFTWARE.
 #include <vector>
 
 #include "types.h"
+#include "kdtree.h"
+#include "oct_normals.h"
+#include "quantized_cloud.h"
+
+// Which medial balls are stored in ma_data, with both the interior balls come first
+enum ma_sides {
+   MA_INNER = 1,
+   MA_OUTER = 2,
+   MA_BOTH = 3
+};
 
 struct ma_data {
    PointCloud::Ptr coords;
+   // World coordinates of the zero of coords and ma_coords. When the points were read from a quantized
+   // format, quantized tells how to get their original integers back from coords.
+   double origin[3] = { 0, 0, 0 };
+   quantized_cloud quantized;
    NormalCloud::Ptr normals;
+   // The normals in octahedral encoding instead, to save memory on large clouds. See point_normal().
+   oct_normals packed_normals;
    PointCloud::Ptr ma_coords;
-   std::vector<int> ma_qidx;
+   std::vector<Index> ma_qidx;
    std::vector<float> ma_radius;
+   ma_sides sides = MA_BOTH;
 
    std::vector<float> lfs;
    std::vector<bool> mask;
 
-   pcl::search::KdTree<Point>::Ptr kd_tree;
+   // When the points were reordered (see morton_sort), the index in the input of every point
+   std::vector<Index> order;
+
+   flat_kdtree::Ptr kd_tree;
 };
 
+// Number of medial balls in madata, one per point for each stored side
+inline size_t ma_size(const ma_data &madata) {
+   return madata.coords->size() * (madata.sides == MA_BOTH ? 2 : 1);
+}
+
+// Whether coords and ma_coords are relative to a world origin, rather than in the coordinates of the input
+inline bool has_origin(const ma_data &madata) {
+   return madata.quantized.active || madata.origin[0] != 0 || madata.origin[1] != 0 || madata.origin[2] != 0;
+}
+
+// Normal of point i, from whichever of normals and packed_normals holds them
+inline Vector3 point_normal(const ma_data &madata, size_t i) {
+   if (!madata.packed_normals.empty())
+      return madata.packed_normals[i];
+   return (*madata.normals)[i].getNormalVector3fMap();
+}
+
+// Replaces the float normals by packed_normals with the given number of bits (16 or 32)
+inline void pack_normals(ma_data &madata, int bits) {
+   if (!madata.normals)
+      return;
+   madata.packed_normals.assign(*madata.normals, bits);
+   madata.normals.reset();
+}
+
 #endif
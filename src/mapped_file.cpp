@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+inline void mapping_error(const std::string &message, const std::string &path) {
+   std::cerr << message << " " << path << std::endl;
+   exit(1);
+}
+
+file_view::file_view(std::string path, file_access access)
+   : path_(path), map_(nullptr), map_size_(0) {
+   // windows fix
+   std::replace(path_.begin(), path_.end(), '\\', '/');
+
+#ifdef _WIN32
+   file_ = CreateFileA(path_.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      access == FILE_RANDOM ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+   if (file_ == INVALID_HANDLE_VALUE)
+      mapping_error("Invalid file path", path_);
+   LARGE_INTEGER file_size;
+   GetFileSizeEx(file_, &file_size);
+   map_size_ = size_t(file_size.QuadPart);
+   mapping_ = map_size_ ? CreateFileMappingA(file_, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+   if (mapping_)
+      map_ = MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+#else
+   int fd = open(path_.c_str(), O_RDONLY);
+   if (fd == -1)
+      mapping_error("Invalid file path", path_);
+   struct stat st;
+   if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      map_size_ = size_t(st.st_size);
+      map_ = mmap(nullptr, map_size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map_ == MAP_FAILED)
+         map_ = nullptr;
+      else
+         // let the kernel read ahead only for files that are read front to back
+         madvise(map_, map_size_, access == FILE_RANDOM ? MADV_RANDOM : MADV_SEQUENTIAL);
+   }
+   close(fd);
+#endif
+   if (!map_)
+      mapping_error("Could not map file", path_);
+}
+
+file_view::~file_view() {
+#ifdef _WIN32
+   if (map_)
+      UnmapViewOfFile(map_);
+   if (mapping_)
+      CloseHandle(mapping_);
+   CloseHandle(file_);
+#else
+   if (map_)
+      munmap(map_, map_size_);
+#endif
+}
+
+file_writer::file_writer(std::string path, size_t size)
+   : path_(path), map_(nullptr), map_size_(size) {
+   // windows fix
+   std::replace(path_.begin(), path_.end(), '\\', '/');
+
+#ifdef _WIN32
+   mapping_ = NULL;
+   file_ = CreateFileA(path_.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+   if (file_ == INVALID_HANDLE_VALUE)
+      mapping_error("Could not create file", path_);
+   mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE, DWORD(uint64_t(map_size_) >> 32), DWORD(map_size_ & 0xffffffff), NULL);
+   if (mapping_)
+      map_ = MapViewOfFile(mapping_, FILE_MAP_WRITE, 0, 0, 0);
+#else
+   int fd = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if (fd == -1)
+      mapping_error("Could not create file", path_);
+   // Allocate the blocks up front: a store to a mapped page that finds the disk full raises SIGBUS
+   // instead of an error we can report. Where the file system can't do that we fall back to a sparse file.
+   int err = EINVAL;
+#ifndef __APPLE__
+   err = posix_fallocate(fd, 0, off_t(map_size_));
+#endif
+   if (err == EINVAL || err == EOPNOTSUPP)
+      err = ftruncate(fd, off_t(map_size_)) == 0 ? 0 : errno;
+   if (err != 0) {
+      close(fd);
+      unlink(path_.c_str());
+      mapping_error(std::string("Could not reserve space (") + std::strerror(err) + ") for file", path_);
+   }
+   map_ = mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (map_ == MAP_FAILED)
+      map_ = nullptr;
+   close(fd);
+#endif
+   if (!map_)
+      mapping_error("Could not map file", path_);
+}
+
+file_writer::~file_writer() {
+#ifdef _WIN32
+   UnmapViewOfFile(map_);
+   CloseHandle(mapping_);
+   CloseHandle(file_);
+#else
+   munmap(map_, map_size_);
+#endif
+}
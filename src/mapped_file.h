@@ -0,0 +1,83 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_MAPPED_FILE_
+#define MASBCPP_MAPPED_FILE_
+
+#include <cstddef>
+#include <string>
+
+// How a mapped file is going to be read, which the operating system uses to read ahead or not
+enum file_access {
+   FILE_SEQUENTIAL, // front to back, such as the arrays of .npy files
+   FILE_RANDOM      // in no particular order, such as a kd-tree
+};
+
+// Read-only mapping of a whole file. The operating system pages the data in when it is first touched
+// and can drop the pages again under memory pressure, since they are backed by the file.
+class file_view {
+public:
+   // Maps the file, prints an error and exits if it can't be opened
+   explicit file_view(std::string path, file_access access = FILE_SEQUENTIAL);
+   ~file_view();
+
+   const char *data() const { return static_cast<const char *>(map_); }
+   size_t size() const { return map_size_; }
+   const std::string &path() const { return path_; }
+
+   file_view(const file_view &) = delete;
+   file_view &operator=(const file_view &) = delete;
+
+private:
+   std::string path_;
+   void *map_;
+   size_t map_size_;
+#ifdef _WIN32
+   void *file_, *mapping_;
+#endif
+};
+
+// A file that is created at its final size and mapped for writing, so that threads can fill disjoint
+// parts of it in place. The file is complete once the writer is destroyed.
+class file_writer {
+public:
+   // Creates the file, prints an error and exits if it can't be created or the disk has no room for it
+   file_writer(std::string path, size_t size);
+   ~file_writer();
+
+   char *data() { return static_cast<char *>(map_); }
+   size_t size() const { return map_size_; }
+   const std::string &path() const { return path_; }
+
+   file_writer(const file_writer &) = delete;
+   file_writer &operator=(const file_writer &) = delete;
+
+private:
+   std::string path_;
+   void *map_;
+   size_t map_size_;
+#ifdef _WIN32
+   void *file_, *mapping_;
+#endif
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <string>
+
+#include <tclap/CmdLine.h>
+
+#include "tile_farm.h"
+
+int main(int argc, char **argv) {
+   // parse command line arguments
+   try {
+      TCLAP::CmdLine cmd("Processes the tiles of a point cloud with separate worker processes and merges their results, see also https://github.com/tudelft3d/masbcpp", ' ', "0.1");
+
+      TCLAP::UnlabeledValueArg<std::string> inputArg("input", "path to directory with inside it a 'coords.npy' file; a Nx3 float array where N is the number of input points.", true, "", "input dir", cmd);
+      TCLAP::UnlabeledValueArg<std::string> outputArg("output", "path to output directory. The tiles are written to its 'tiles' directory while they are processed", false, "", "output dir", cmd);
+
+      TCLAP::ValueArg<double> tileArg("t", "tile", "edge length of the square tiles in x and y. By default it follows from --max_points and the average point density", false, 0, "double", cmd);
+      TCLAP::ValueArg<double> haloArg("", "halo", "width of the band of neighbouring points that is processed with each tile. The balls match those of processing all points at once when it is at least twice the initial radius of the workers (200 by default)", false, 400, "double", cmd);
+      TCLAP::ValueArg<size_t> maxPointsArg("m", "max_points", "most points, halo included, in a tile. Tiles with more points are split in four", false, 20000000, "size", cmd);
+
+      TCLAP::ValueArg<int> processesArg("j", "processes", "number of workers that run at the same time", false, 4, "int", cmd);
+      TCLAP::ValueArg<int> threadsArg("", "threads", "number of OpenMP threads of each worker. By default the cores are divided over the workers", false, 0, "int", cmd);
+      TCLAP::ValueArg<int> retriesArg("", "retries", "number of times a tile whose worker fails is run again", false, 2, "int", cmd);
+      TCLAP::ValueArg<std::string> workerArg("", "worker", "program that processes a tile directory, given as its first argument. By default masb_tiles from the directory of masb_farm, which computes the normals, medial balls and LFS of the tile", false, "", "program", cmd);
+      TCLAP::ValueArg<std::string> argsArg("", "args", "further arguments for the workers, eg. \"-r 100 -s both -z\"", false, "", "arguments", cmd);
+      TCLAP::SwitchArg keepSwitch("", "keep", "keep the tile directories after merging", cmd, false);
+
+      cmd.parse(argc, argv);
+
+      tile_parameters tile_params;
+      tile_params.tile_size = tileArg.getValue();
+      tile_params.halo = haloArg.getValue();
+      tile_params.max_points = maxPointsArg.getValue();
+      tile_params.morton = false;
+
+      farm_parameters farm_params;
+      farm_params.default_worker = !workerArg.isSet();
+      if (farm_params.default_worker) {
+         std::string self = argv[0];
+         std::replace(self.begin(), self.end(), '\\', '/');
+         size_t slash = self.rfind('/');
+         farm_params.worker = (slash == std::string::npos ? std::string() : self.substr(0, slash + 1)) + "masb_tiles";
+      }
+      else
+         farm_params.worker = workerArg.getValue();
+      farm_params.worker_args = argsArg.getValue();
+      farm_params.processes = std::max(1, processesArg.getValue());
+#ifndef WITH_OPENMP
+      // the workers are run from OpenMP threads, without those one at a time
+      if (farm_params.processes > 1) {
+         if (processesArg.isSet())
+            throw TCLAP::ArgException("needs a build with OpenMP to run more than one worker at a time", "processes");
+         farm_params.processes = 1;
+      }
+#endif
+      farm_params.threads = threadsArg.getValue();
+      farm_params.retries = std::max(0, retriesArg.getValue());
+      farm_params.keep = keepSwitch.getValue();
+
+      std::string output_path = outputArg.isSet() ? outputArg.getValue() : inputArg.getValue();
+
+      if (!run_farm(inputArg.getValue(), output_path, tile_params, farm_params))
+         return 1;
+   }
+   catch (TCLAP::ArgException &e) { std::cerr << "Error: " << e.error() << " for " << e.argId() << std::endl; }
+
+   return 0;
+}
@@ -0,0 +1,300 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include <tclap/CmdLine.h>
+
+#include "compute_normals_processing.h"
+#include "compute_ma_processing.h"
+#include "simplify_processing.h"
+#include "io.h"
+#include "madata.h"
+#include "morton.h"
+#include "xyz_writer.h"
+
+// The processing stages in the order they run
+enum pipeline_stage {
+   STAGE_NORMALS,
+   STAGE_MA,
+   STAGE_LFS,
+   STAGE_SIMPLIFY
+};
+
+const char *const stage_names[] = { "normals", "ma", "lfs", "simplify" };
+
+pipeline_stage stage_from_name(const std::string &name) {
+   for (int s = STAGE_NORMALS; s <= STAGE_SIMPLIFY; s++)
+      if (name == stage_names[s])
+         return pipeline_stage(s);
+   return STAGE_NORMALS;
+}
+
+// compute_lfs() with only the interior balls drops the exterior ma_coords, when those are still to be written
+// it runs on a copy of the interior balls instead
+bool lfs_stage(simplify_parameters &params, ma_data &madata, bool keep_ma_coords) {
+   madata.lfs.resize(madata.coords->size());
+   if (!(params.only_inner && madata.sides == MA_BOTH && keep_ma_coords))
+      return compute_lfs(madata, params.bisec_threshold, params.bisec_k, params.only_inner);
+
+   size_t N = madata.coords->size();
+   ma_data inner = {};
+   inner.coords = madata.coords;
+   inner.sides = MA_INNER;
+   inner.ma_coords.reset(new PointCloud);
+   inner.ma_coords->points.assign(madata.ma_coords->points.begin(), madata.ma_coords->points.begin() + N);
+   inner.ma_qidx.assign(madata.ma_qidx.begin(), madata.ma_qidx.begin() + N);
+   inner.lfs.swap(madata.lfs);
+   bool ok = compute_lfs(inner, params.bisec_threshold, params.bisec_k, true);
+   madata.lfs.swap(inner.lfs);
+   return ok;
+}
+
+int main(int argc, char **argv) {
+   // parse command line arguments
+   try {
+      TCLAP::CmdLine cmd("Runs the normal estimation, MAT point approximation, LFS computation and simplification, or any consecutive part of those, in one process, see also https://github.com/tudelft3d/masbcpp", ' ', "0.1");
+
+      TCLAP::UnlabeledValueArg<std::string> inputArg("input", "path to input directory with inside it a 'coords.npy' file and the arrays that the first stage needs: 'normals.npy' for ma, 'ma_coords_*.npy' and 'ma_qidx_*.npy' for lfs, 'lfs.npy' for simplify", true, "", "input dir", cmd);
+      TCLAP::UnlabeledValueArg<std::string> outputArg("output", "path to output directory", false, "", "output dir", cmd);
+
+      std::vector<std::string> stages(stage_names, stage_names + 4);
+      TCLAP::ValuesConstraint<std::string> stagesConstraint(stages);
+      TCLAP::ValueArg<std::string> fromArg("", "from", "first stage to run", false, "normals", &stagesConstraint, cmd);
+      TCLAP::ValueArg<std::string> toArg("", "to", "last stage to run", false, "simplify", &stagesConstraint, cmd);
+
+      std::vector<std::string> arrays;
+      arrays.push_back("coords");
+      arrays.push_back("normals");
+      arrays.push_back("ma_coords");
+      arrays.push_back("ma_qidx");
+      arrays.push_back("ma_radius");
+      arrays.push_back("lfs");
+      arrays.push_back("mask");
+      arrays.push_back("xyz");
+      TCLAP::ValuesConstraint<std::string> arraysConstraint(arrays);
+      TCLAP::MultiArg<std::string> writeArg("o", "write", "array to write, can be repeated: 'mask' writes 'decimate_lfs.npy' and 'xyz' the points that are kept to 'lfs_simp.xyz'. By default the results of the last stage are written (for simplify the mask and xyz)", false, &arraysConstraint, cmd);
+
+      // normals
+      TCLAP::ValueArg<int> kArg("k", "kneighbours", "number of nearest neighbours to use for PCA", false, 10, "int", cmd);
+      // ma
+      TCLAP::ValueArg<double> denoise_preserveArg("d", "preserve", "denoise preserve threshold", false, 20, "double", cmd);
+      TCLAP::ValueArg<double> denoise_planarArg("p", "planar", "denoise planar threshold", false, 32, "double", cmd);
+      TCLAP::ValueArg<double> initial_radiusArg("r", "radius", "initial ball radius", false, 200, "double", cmd);
+      std::vector<std::string> engines;
+      engines.push_back("shrink");
+      engines.push_back("minradius");
+      engines.push_back("wavefront");
+      TCLAP::ValuesConstraint<std::string> enginesConstraint(engines);
+      TCLAP::ValueArg<std::string> engineArg("e", "engine", "algorithm used to find the medial balls, see compute_ma", false, "shrink", &enginesConstraint, cmd);
+      std::vector<std::string> sides;
+      sides.push_back("inner");
+      sides.push_back("outer");
+      sides.push_back("both");
+      TCLAP::ValuesConstraint<std::string> sidesConstraint(sides);
+      TCLAP::ValueArg<std::string> sidesArg("s", "sides", "compute the interior balls, the exterior balls or both. Results are written to the '_in' and '_out' files respectively", false, "both", &sidesConstraint, cmd);
+      TCLAP::SwitchArg nan_for_initrSwitch("a", "nan", "write nan for points with radius equal to initial radius", cmd, false);
+      TCLAP::SwitchArg warm_startSwitch("w", "warm", "start each ball from the radius of a nearby ball that was already computed instead of the initial radius", cmd, false);
+      // lfs and simplify
+      TCLAP::ValueArg<double> bisecArg("b", "bisec", "bisector threshold used to clean the MAT points before LFS computation, see simplify", false, 2, "double", cmd);
+      TCLAP::ValueArg<int> biseckArg("", "biseck", "number of neighbours used during bisector-based outlier cleaning prior to LFS computation, see simplify", false, 4, "int", cmd);
+      TCLAP::SwitchArg innerSwitch("i", "inner", "compute LFS using only interior MAT points", cmd, false);
+      TCLAP::ValueArg<double> epsilonArg("", "epsilon", "degree of simplification, see simplify", false, 0.4, "double", cmd);
+      TCLAP::ValueArg<double> cellsizeArg("c", "cellsize", "cellsize used during grid-based lfs simplification, see simplify", false, 0.5, "double", cmd);
+      TCLAP::ValueArg<double> maxdensArg("u", "upper", "upper bound point density in pts/unit^2", false, 0, "double", cmd);
+      TCLAP::ValueArg<double> mindensArg("l", "lower", "lower bound point density in pts/unit^2", false, 0, "double", cmd);
+      TCLAP::ValueArg<double> fake3dArg("f", "fake3d", "use a 2D grid with this elevation jump threshold, see simplify", false, 0.5, "double", cmd);
+      TCLAP::SwitchArg squaredSwitch("", "squared", "use squared LFS during simplification", cmd, false);
+
+      TCLAP::SwitchArg mortonSwitch("z", "morton", "sort the points in Morton (Z-order) before processing so that nearby points are processed together, which is faster for large point clouds. The outputs keep the input order", cmd, false);
+      TCLAP::SwitchArg kdtreeCacheSwitch("", "kdtree_cache", "read the kd-tree over the points from a file in the input directory that an earlier run with the same points and -z setting wrote, or build it and write that file. Saves the tree construction when the same points are processed again", cmd, false);
+      TCLAP::ValueArg<std::string> lasArg("", "las", "read the points from this LAS file instead of 'coords.npy', relative to the center of their bounding box (written to 'origin.npy'). Other arrays are still read from the input directory", false, "", "las file", cmd);
+      TCLAP::ValueArg<std::string> plyArg("", "ply", "read the points and the arrays the first stage needs from the vertices of this binary PLY file instead of the input directory", false, "", "ply file", cmd);
+      TCLAP::ValueArg<std::string> npzArg("", "npz", "write the arrays into this zip compressed .npz archive instead of separate .npy files in the output directory", false, "", "npz file", cmd);
+      std::vector<int> normal_bits;
+      normal_bits.push_back(16);
+      normal_bits.push_back(32);
+      TCLAP::ValuesConstraint<int> normalBitsConstraint(normal_bits);
+      TCLAP::ValueArg<int> octNormalsArg("", "oct_normals", "keep and write the normals in octahedral encoding of 16 or 32 bits instead of 3 floats", false, 32, &normalBitsConstraint, cmd);
+
+      cmd.parse(argc, argv);
+
+      pipeline_stage from = stage_from_name(fromArg.getValue()), to = stage_from_name(toArg.getValue());
+      if (to < from)
+         throw TCLAP::ArgException("comes before --from", "to");
+      auto runs = [&](pipeline_stage s) { return from <= s && s <= to; };
+
+      normals_parameters normals_params;
+      normals_params.k = kArg.getValue();
+
+      ma_parameters ma_params;
+      ma_params.initial_radius = float(initial_radiusArg.getValue());
+      ma_params.denoise_preserve = (M_PI / 180.0) * denoise_preserveArg.getValue();
+      ma_params.denoise_planar = (M_PI / 180.0) * denoise_planarArg.getValue();
+      ma_params.nan_for_initr = nan_for_initrSwitch.getValue();
+      ma_params.warm_start = warm_startSwitch.getValue();
+      ma_params.sides = sidesArg.getValue() == "both" ? MA_BOTH : sidesArg.getValue() == "outer" ? MA_OUTER : MA_INNER;
+      ma_params.engine = engineArg.getValue() == "minradius" ? MA_ENGINE_MINRADIUS : engineArg.getValue() == "wavefront" ? MA_ENGINE_WAVEFRONT : MA_ENGINE_SHRINK;
+
+      simplify_parameters simplify_params;
+      simplify_params.epsilon = epsilonArg.getValue();
+      simplify_params.cellsize = cellsizeArg.getValue();
+      simplify_params.bisec_threshold = (bisecArg.getValue() / 180.0) * M_PI;
+      simplify_params.bisec_k = biseckArg.getValue();
+      simplify_params.compute_lfs = false; // done by the lfs stage
+      simplify_params.elevation_threshold = fake3dArg.getValue();
+      simplify_params.minimum_density = mindensArg.getValue();
+      simplify_params.maximum_density = maxdensArg.getValue();
+      simplify_params.true_z_dim = !fake3dArg.isSet();
+      simplify_params.only_inner = innerSwitch.getValue();
+      simplify_params.squared = squaredSwitch.getValue();
+
+      // The arrays to write, and whether the stages make them or read them
+      io_parameters out = {};
+      bool xyz = false;
+      std::vector<std::string> requested = writeArg.getValue();
+      if (requested.empty()) {
+         const char *const defaults[] = { "normals", "ma_coords", "ma_qidx", "ma_radius", "lfs", "mask", "xyz" };
+         if (to == STAGE_NORMALS)
+            requested.assign(defaults, defaults + 1);
+         else if (to == STAGE_MA)
+            requested.assign(defaults + 1, defaults + 4);
+         else if (to == STAGE_LFS)
+            requested.assign(defaults + 4, defaults + 5);
+         else
+            requested.assign(defaults + 5, defaults + 7);
+      }
+      for (const std::string &a : requested) {
+         bool available = true;
+         if (a == "coords")
+            out.coords = true;
+         else if (a == "normals")
+            available = out.normals = from <= STAGE_MA;
+         else if (a == "ma_coords")
+            available = out.ma_coords = from <= STAGE_LFS && to >= STAGE_MA;
+         else if (a == "ma_qidx")
+            available = out.ma_qidx = from <= STAGE_LFS && to >= STAGE_MA;
+         else if (a == "ma_radius")
+            available = out.ma_radius = from <= STAGE_LFS && to >= STAGE_MA;
+         else if (a == "lfs")
+            available = out.lfs = to >= STAGE_LFS;
+         else if (a == "mask")
+            available = out.mask = to == STAGE_SIMPLIFY;
+         else if (a == "xyz")
+            available = xyz = to == STAGE_SIMPLIFY;
+         if (!available)
+            throw TCLAP::ArgException("is neither computed nor read by the selected stages: " + a, "write");
+      }
+
+      std::string output_path = outputArg.isSet() ? outputArg.getValue() : inputArg.getValue();
+      std::replace(output_path.begin(), output_path.end(), '\\', '/');
+
+      std::cout << "Stages: " << fromArg.getValue() << " to " << toArg.getValue() << std::endl;
+
+      // Read what the first stage needs
+      io_parameters in = {};
+      in.coords = !lasArg.isSet();
+      in.normals = from == STAGE_MA;
+      in.normal_bits = octNormalsArg.isSet() ? octNormalsArg.getValue() : 0;
+      in.ma_coords = from == STAGE_LFS;
+      in.ma_qidx = from == STAGE_LFS;
+      in.ma_radius = from == STAGE_LFS && out.ma_radius;
+      if (from == STAGE_LFS && simplify_params.only_inner && !(out.ma_coords || out.ma_qidx || out.ma_radius))
+         in.sides = MA_INNER;
+      in.lfs = from == STAGE_SIMPLIFY;
+
+      ma_data madata = {};
+      if (lasArg.isSet())
+         las2madata(lasArg.getValue(), madata);
+      if (plyArg.isSet())
+         ply2madata(plyArg.getValue(), madata, in);
+      else if (in.coords || in.normals || in.ma_coords || in.lfs)
+         npy2madata(inputArg.getValue(), madata, in);
+
+      std::cout << "Point count: " << madata.coords->size() << std::endl;
+
+      if (mortonSwitch.getValue())
+         morton_sort(madata);
+      if (kdtreeCacheSwitch.getValue() && (runs(STAGE_NORMALS) || runs(STAGE_MA)))
+         attach_kdtree(inputArg.getValue(), madata);
+
+      // All stages work on the same arrays and share the kd-tree over the points
+      if (runs(STAGE_NORMALS)) {
+         madata.normals.reset(new NormalCloud);
+         compute_normals(normals_params, madata);
+         if (octNormalsArg.isSet())
+            pack_normals(madata, octNormalsArg.getValue());
+      }
+      if (runs(STAGE_MA)) {
+         compute_masb_points(ma_params, madata);
+         if (!out.normals) {
+            madata.normals.reset();
+            madata.packed_normals.clear();
+         }
+      }
+      // As in simplify, without LFS values no points are kept
+      bool have_lfs = true;
+      if (runs(STAGE_LFS)) {
+         have_lfs = lfs_stage(simplify_params, madata, out.ma_coords);
+         if (!have_lfs)
+            std::cout << "No MAT points are left after cleaning, the lfs can't be computed" << std::endl;
+         if (!(out.ma_coords || out.ma_qidx || out.ma_radius)) {
+            madata.ma_coords.reset();
+            madata.ma_qidx = std::vector<Index>();
+            madata.ma_radius = std::vector<float>();
+         }
+      }
+      if (runs(STAGE_SIMPLIFY)) {
+         madata.mask.resize(madata.coords->size());
+         if (have_lfs)
+            simplify_lfs(simplify_params, madata);
+      }
+      restore_order(madata);
+
+      if (to == STAGE_SIMPLIFY) {
+         size_t cnt = 0;
+         for (size_t i = 0; i < madata.coords->size(); i++)
+            if (madata.mask[i]) cnt++;
+         std::cout << cnt << " out of " << madata.coords->size() << " points remaining [" << int(100 * float(cnt) / madata.coords->size()) << "%]" << std::endl;
+      }
+
+      // Output results
+      if (out.coords || out.normals || out.ma_coords || out.ma_qidx || out.ma_radius || out.lfs || out.mask) {
+         if (npzArg.isSet())
+            madata2npz(npzArg.getValue(), madata, out);
+         else
+            madata2npy(output_path, madata, out);
+      }
+      if (xyz) {
+         // points read in world coordinates are also written in them
+         if (!madata.quantized.active)
+            write_xyz(output_path + "/lfs_simp.xyz", *madata.coords, madata.mask);
+         else
+            write_xyz(output_path + "/lfs_simp.xyz", *madata.coords, madata.quantized, madata.mask);
+      }
+   }
+   catch (TCLAP::ArgException &e) { std::cerr << "Error: " << e.error() << " for " << e.argId() << std::endl; }
+
+   return 0;
+}
@@ -0,0 +1,150 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include <tclap/CmdLine.h>
+
+#include "tiled_processing.h"
+#include "types.h"
+
+int main(int argc, char **argv) {
+   // parse command line arguments
+   try {
+      TCLAP::CmdLine cmd("Computes the normals, a MAT point approximation and the LFS of point clouds that don't fit in memory, one spatial tile at a time, see also https://github.com/tudelft3d/masbcpp", ' ', "0.1");
+
+      TCLAP::UnlabeledValueArg<std::string> inputArg("input", "path to directory with inside it a 'coords.npy' file; a Nx3 float array where N is the number of input points.", true, "", "input dir", cmd);
+      TCLAP::UnlabeledValueArg<std::string> outputArg("output", "path to output directory", false, "", "output dir", cmd);
+
+      TCLAP::ValueArg<double> tileArg("t", "tile", "edge length of the square tiles in x and y. By default it follows from --max_points and the average point density", false, 0, "double", cmd);
+      TCLAP::ValueArg<double> haloArg("", "halo", "width of the band of neighbouring points that is processed with each tile. The balls match those of processing all points at once when it is at least twice the initial radius, which is the default", false, 0, "double", cmd);
+      TCLAP::ValueArg<size_t> maxPointsArg("m", "max_points", "most points, halo included, to process at once. Tiles with more points are split in four. Processing takes roughly 300 bytes per point", false, 20000000, "size", cmd);
+      TCLAP::SwitchArg mortonSwitch("z", "morton", "sort the points of each tile in Morton (Z-order) before processing, so that nearby points are processed together", cmd, false);
+
+      TCLAP::ValueArg<int> kArg("k", "kneighbours", "number of nearest neighbours to use for PCA", false, 10, "int", cmd);
+
+      TCLAP::ValueArg<double> denoise_preserveArg("d", "preserve", "denoise preserve threshold", false, 20, "double", cmd);
+      TCLAP::ValueArg<double> denoise_planarArg("p", "planar", "denoise planar threshold", false, 32, "double", cmd);
+      TCLAP::ValueArg<double> initial_radiusArg("r", "radius", "initial ball radius", false, 200, "double", cmd);
+
+      std::vector<std::string> engines;
+      engines.push_back("shrink");
+      engines.push_back("minradius");
+      engines.push_back("wavefront");
+      TCLAP::ValuesConstraint<std::string> enginesConstraint(engines);
+      TCLAP::ValueArg<std::string> engineArg("e", "engine", "algorithm used to find the medial balls, see compute_ma", false, "shrink", &enginesConstraint, cmd);
+
+      std::vector<std::string> sides;
+      sides.push_back("inner");
+      sides.push_back("outer");
+      sides.push_back("both");
+      TCLAP::ValuesConstraint<std::string> sidesConstraint(sides);
+      TCLAP::ValueArg<std::string> sidesArg("s", "sides", "compute the interior balls, the exterior balls or both. Results are written to the '_in' and '_out' files respectively", false, "inner", &sidesConstraint, cmd);
+
+      TCLAP::SwitchArg nan_for_initrSwitch("a", "nan", "write nan for points with radius equal to initial radius", cmd, false);
+      TCLAP::SwitchArg warm_startSwitch("w", "warm", "start each ball from the radius of a nearby ball that was already computed instead of the initial radius", cmd, false);
+
+      TCLAP::ValueArg<double> bisecArg("b", "bisec", "bisector threshold used to clean the MAT points before LFS computation, see simplify", false, 2, "double", cmd);
+      TCLAP::ValueArg<int> biseckArg("", "biseck", "number of neighbours used during bisector-based outlier cleaning prior to LFS computation, see simplify", false, 4, "int", cmd);
+      TCLAP::SwitchArg innerSwitch("i", "inner", "compute LFS using only interior MAT points", cmd, false);
+      TCLAP::SwitchArg nolfsSwitch("", "no_lfs", "don't compute the LFS", cmd, false);
+
+      std::vector<int> normal_bits;
+      normal_bits.push_back(16);
+      normal_bits.push_back(32);
+      TCLAP::ValuesConstraint<int> normalBitsConstraint(normal_bits);
+      TCLAP::ValueArg<int> octNormalsArg("", "oct_normals", "keep and write the normals in octahedral encoding of 16 or 32 bits, as a 1D uint16 or uint32 array, instead of Nx3 floats", false, 32, &normalBitsConstraint, cmd);
+      TCLAP::SwitchArg radiusOnlySwitch("", "radius_only", "write only the ma_qidx and ma_radius arrays, without ma_coords, see compute_ma", cmd, false);
+
+      cmd.parse(argc, argv);
+
+      normals_parameters normals_params;
+      normals_params.k = kArg.getValue();
+
+      ma_parameters ma_params;
+      ma_params.initial_radius = float(initial_radiusArg.getValue());
+      ma_params.denoise_preserve = (M_PI / 180.0) * denoise_preserveArg.getValue();
+      ma_params.denoise_planar = (M_PI / 180.0) * denoise_planarArg.getValue();
+      ma_params.nan_for_initr = nan_for_initrSwitch.getValue();
+      ma_params.warm_start = warm_startSwitch.getValue();
+      ma_params.sides = sidesArg.getValue() == "both" ? MA_BOTH : sidesArg.getValue() == "outer" ? MA_OUTER : MA_INNER;
+      ma_params.engine = engineArg.getValue() == "minradius" ? MA_ENGINE_MINRADIUS : engineArg.getValue() == "wavefront" ? MA_ENGINE_WAVEFRONT : MA_ENGINE_SHRINK;
+
+      simplify_parameters lfs_params = {};
+      lfs_params.bisec_threshold = (bisecArg.getValue() / 180.0) * M_PI;
+      lfs_params.bisec_k = biseckArg.getValue();
+      lfs_params.only_inner = innerSwitch.getValue();
+
+      tile_parameters tile_params;
+      tile_params.tile_size = tileArg.getValue();
+      tile_params.halo = haloArg.isSet() ? haloArg.getValue() : 2 * initial_radiusArg.getValue();
+      tile_params.max_points = maxPointsArg.getValue();
+      tile_params.morton = mortonSwitch.getValue();
+
+      std::string output_path = outputArg.isSet() ? outputArg.getValue() : inputArg.getValue();
+
+      std::cout << "Parameters: k=" << normals_params.k << ", denoise_preserve=" << denoise_preserveArg.getValue() << ", denoise_planar=" << denoise_planarArg.getValue() << ", initial_radius=" << ma_params.initial_radius << ", engine=" << engineArg.getValue() << ", sides=" << sidesArg.getValue() << "\n";
+
+      io_parameters io_params = {};
+      io_params.normals = true;
+      io_params.normal_bits = octNormalsArg.isSet() ? octNormalsArg.getValue() : 0;
+      io_params.ma_coords = !radiusOnlySwitch.getValue();
+      io_params.ma_qidx = true;
+      io_params.ma_radius = true;
+      io_params.lfs = !nolfsSwitch.getValue();
+
+      compute_tiled(inputArg.getValue(), output_path, tile_params, normals_params, ma_params, lfs_params, io_params);
+
+      {
+         std::string output_path_metadata = output_path + "/masb_tiles";
+         std::replace(output_path_metadata.begin(), output_path_metadata.end(), '\\', '/');
+
+         std::ofstream metadata(output_path_metadata.c_str());
+         if (!metadata) {
+            throw TCLAP::ArgParseException("invalid filepath", output_path);
+         }
+
+         metadata
+            << "tile " << tile_params.tile_size << std::endl
+            << "halo " << tile_params.halo << std::endl
+            << "max_points " << tile_params.max_points << std::endl
+            << "k " << normals_params.k << std::endl
+            << "initial_radius " << ma_params.initial_radius << std::endl
+            << "nan_for_initr " << ma_params.nan_for_initr << std::endl
+            << "denoise_preserve " << denoise_preserveArg.getValue() << std::endl
+            << "denoise_planar " << denoise_planarArg.getValue() << std::endl
+            << "engine " << engineArg.getValue() << std::endl
+            << "warm_start " << ma_params.warm_start << std::endl
+            << "sides " << sidesArg.getValue() << std::endl
+            << "radius_only " << radiusOnlySwitch.getValue() << std::endl
+            << "bisec " << bisecArg.getValue() << std::endl
+            << "biseck " << lfs_params.bisec_k << std::endl
+            << "only_inner " << lfs_params.only_inner << std::endl;
+         metadata.close();
+      }
+   }
+   catch (TCLAP::ArgException &e) { std::cerr << "Error: " << e.error() << " for " << e.argId() << std::endl; }
+
+   return 0;
+}
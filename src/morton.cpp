@@ -0,0 +1,185 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "morton.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <pcl/common/common.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+inline uint32_t quantize(Scalar v) {
+   // non-finite points end up in the first cell
+   return (v >= 0 && v <= Scalar(0x1fffff)) ? uint32_t(v) : 0;
+}
+
+// Sorts v using all threads: every thread sorts one slice, then the slices are merged pairwise
+template <class T>
+void parallel_sort(std::vector<T> &v) {
+   int slices = 1;
+#ifdef WITH_OPENMP
+   slices = omp_get_max_threads();
+#endif
+   if (slices < 2 || v.size() < 100000) {
+      std::sort(v.begin(), v.end());
+      return;
+   }
+
+   std::vector<size_t> bounds(slices + 1);
+   for (int s = 0; s <= slices; s++)
+      bounds[s] = v.size() * s / slices;
+
+#pragma omp parallel for
+   for (int s = 0; s < slices; s++)
+      std::sort(v.begin() + bounds[s], v.begin() + bounds[s + 1]);
+
+   for (int width = 1; width < slices; width *= 2) {
+#pragma omp parallel for
+      for (int s = 0; s < slices - width; s += 2 * width) {
+         size_t end = bounds[std::min(s + 2 * width, slices)];
+         std::inplace_merge(v.begin() + bounds[s], v.begin() + bounds[s + width], v.begin() + end);
+      }
+   }
+}
+
+void morton_order(const PointCloud &cloud, std::vector<Index> &order) {
+   order.resize(cloud.size());
+   if (cloud.size() == 0)
+      return;
+
+   Point minPt, maxPt;
+   pcl::getMinMax3D(cloud, minPt, maxPt);
+   Scalar extent = std::max(maxPt.x - minPt.x, std::max(maxPt.y - minPt.y, maxPt.z - minPt.z));
+   Scalar scale = extent > 0 ? Scalar(0x1fffff) / extent : 0;
+
+   std::vector<std::pair<uint64_t, Index> > codes(cloud.size());
+#pragma omp parallel for
+   for (Index i = 0; i < cloud.size(); i++) {
+      const Point &pt = cloud[i];
+      codes[i].first = morton_code(
+         quantize((pt.x - minPt.x) * scale),
+         quantize((pt.y - minPt.y) * scale),
+         quantize((pt.z - minPt.z) * scale));
+      codes[i].second = i;
+   }
+   parallel_sort(codes);
+
+#pragma omp parallel for
+   for (Index i = 0; i < codes.size(); i++)
+      order[i] = codes[i].second;
+}
+
+// Moves element order[k] to k (forward) or element k to order[k] (backward), for each block of
+// order.size() elements in v. Arrays that hold both interior and exterior results have two blocks.
+template <class Array>
+void permute(Array &v, const std::vector<Index> &order, bool forward) {
+   size_t n = order.size();
+   if (n == 0 || v.size() == 0)
+      return;
+   Array permuted(v.size());
+   for (size_t block = 0; block + n <= v.size(); block += n) {
+#pragma omp parallel for
+      for (Index k = 0; k < n; k++) {
+         if (forward)
+            permuted[block + k] = v[block + order[k]];
+         else
+            permuted[block + order[k]] = v[block + k];
+      }
+   }
+   v.swap(permuted);
+}
+
+// std::vector<bool> packs its elements into shared words, so it can't be written in parallel
+void permute(std::vector<bool> &v, const std::vector<Index> &order, bool forward) {
+   size_t n = order.size();
+   if (n == 0 || v.size() == 0)
+      return;
+   std::vector<bool> permuted(v.size());
+   for (size_t block = 0; block + n <= v.size(); block += n)
+      for (size_t k = 0; k < n; k++) {
+         if (forward)
+            permuted[block + k] = v[block + order[k]];
+         else
+            permuted[block + order[k]] = v[block + k];
+      }
+   v.swap(permuted);
+}
+
+template <class CloudPtr>
+void permute_points(CloudPtr &cloud, const std::vector<Index> &order, bool forward) {
+   if (cloud)
+      permute(cloud->points, order, forward);
+}
+
+// Renames the point indices stored in qidx: i becomes map[i]
+void remap_indices(std::vector<Index> &qidx, const std::vector<Index> &map) {
+#pragma omp parallel for
+   for (Index i = 0; i < qidx.size(); i++)
+      if (qidx[i] != -1)
+         qidx[i] = map[qidx[i]];
+}
+
+void morton_sort(ma_data &madata) {
+   morton_order(*madata.coords, madata.order);
+
+   std::vector<Index> inverse(madata.order.size());
+#pragma omp parallel for
+   for (Index k = 0; k < madata.order.size(); k++)
+      inverse[madata.order[k]] = k;
+
+   permute_points(madata.coords, madata.order, true);
+   permute_points(madata.normals, madata.order, true);
+   permute(madata.packed_normals.oct32, madata.order, true);
+   permute(madata.packed_normals.oct16, madata.order, true);
+   permute_points(madata.ma_coords, madata.order, true);
+   permute(madata.ma_qidx, madata.order, true);
+   remap_indices(madata.ma_qidx, inverse);
+   permute(madata.ma_radius, madata.order, true);
+   permute(madata.lfs, madata.order, true);
+   permute(madata.mask, madata.order, true);
+
+   // a tree over the old order is of no use anymore
+   madata.kd_tree.reset();
+}
+
+void restore_order(ma_data &madata) {
+   if (madata.order.empty())
+      return;
+
+   permute_points(madata.coords, madata.order, false);
+   permute_points(madata.normals, madata.order, false);
+   permute(madata.packed_normals.oct32, madata.order, false);
+   permute(madata.packed_normals.oct16, madata.order, false);
+   permute_points(madata.ma_coords, madata.order, false);
+   permute(madata.ma_qidx, madata.order, false);
+   remap_indices(madata.ma_qidx, madata.order);
+   permute(madata.ma_radius, madata.order, false);
+   permute(madata.lfs, madata.order, false);
+   permute(madata.mask, madata.order, false);
+
+   madata.order.clear();
+   madata.kd_tree.reset();
+}
@@ -0,0 +1,59 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_MORTON_
+#define MASBCPP_MORTON_
+
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+#include "madata.h"
+
+// Spreads the lower 21 bits of v so that there are two zero bits between each of them
+inline uint64_t morton_spread(uint64_t v) {
+   v &= 0x1fffff;
+   v = (v | v << 32) & 0x1f00000000ffffull;
+   v = (v | v << 16) & 0x1f0000ff0000ffull;
+   v = (v | v << 8) & 0x100f00f00f00f00full;
+   v = (v | v << 4) & 0x10c30c30c30c30c3ull;
+   v = (v | v << 2) & 0x1249249249249249ull;
+   return v;
+}
+
+// 63 bit Morton (Z-order) code of a point with 21 bit integer coordinates
+inline uint64_t morton_code(uint32_t x, uint32_t y, uint32_t z) {
+   return morton_spread(x) | morton_spread(y) << 1 | morton_spread(z) << 2;
+}
+
+// Fills order with the indices of the points in cloud sorted by the Morton code of their
+// position within the bounding box of the cloud, so that consecutive points are close in space.
+void morton_order(const PointCloud &cloud, std::vector<Index> &order);
+
+// Sorts all arrays in madata in Morton order of the coords and stores the permutation in madata.order.
+// The processing stages then visit nearby points one after another, which keeps their kd-tree nodes in cache.
+void morton_sort(ma_data &madata);
+
+// Puts all arrays in madata back in the order from before morton_sort(), ma_qidx values included.
+void restore_order(ma_data &madata);
+
+#endif
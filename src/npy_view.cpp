@@ -0,0 +1,135 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "npy_view.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+inline void npy_error(const std::string &message, const std::string &path) {
+   std::cerr << message << " " << path << std::endl;
+   exit(1);
+}
+
+npy_view::npy_view(std::string path)
+   : file_(path), type_(0), word_size_(0), fortran_order_(false), little_endian_(true), data_(nullptr) {
+   const std::string &file_path = file_.path();
+   const char *bytes = file_.data();
+   size_t file_size = file_.size();
+
+   // Header: magic string, version, header length and a python dict literal describing the array
+   if (file_size < 10 || std::memcmp(bytes, "\x93NUMPY", 6) != 0)
+      npy_error("Invalid .npy file", file_path);
+   size_t header_start, header_length;
+   if (bytes[6] == 1) {
+      header_start = 10;
+      header_length = size_t((unsigned char)bytes[8]) | size_t((unsigned char)bytes[9]) << 8;
+   } else {
+      header_start = 12;
+      if (file_size < header_start)
+         npy_error("Invalid .npy file", file_path);
+      header_length = 0;
+      for (int b = 3; b >= 0; b--)
+         header_length = header_length << 8 | (unsigned char)bytes[8 + b];
+   }
+   if (header_start + header_length > file_size)
+      npy_error("Invalid .npy file", file_path);
+   std::string header(bytes + header_start, header_length);
+
+   size_t descr = header.find("'descr'");
+   size_t fortran = header.find("'fortran_order'");
+   size_t shape = header.find("'shape'");
+   if (descr == std::string::npos || fortran == std::string::npos || shape == std::string::npos)
+      npy_error("Invalid .npy file", file_path);
+
+   // 'descr': '<f4' is the byte order, the type character and the size in bytes
+   size_t begin = header.find('\'', descr + 7), end = header.find('\'', begin + 1);
+   if (end == std::string::npos || end - begin < 4)
+      npy_error("Invalid .npy file", file_path);
+   std::string type = header.substr(begin + 1, end - begin - 1);
+   little_endian_ = type[0] == '<' || type[0] == '|' || type[0] == '=';
+   type_ = type[1];
+   word_size_ = size_t(std::atoi(type.c_str() + 2));
+
+   size_t value = header.find_first_not_of(" :", fortran + 15);
+   fortran_order_ = value != std::string::npos && header.compare(value, 4, "True") == 0;
+
+   // 'shape': (N, 3), or (N,) for 1D arrays
+   begin = header.find('(', shape);
+   end = header.find(')', begin);
+   if (end == std::string::npos)
+      npy_error("Invalid .npy file", file_path);
+   const char *p = header.c_str() + begin + 1, *last = header.c_str() + end;
+   while (p < last) {
+      char *next;
+      unsigned long long n = std::strtoull(p, &next, 10);
+      if (next == p)
+         break;
+      shape_.push_back(size_t(n));
+      p = next;
+      while (p < last && (*p == ',' || *p == ' '))
+         p++;
+   }
+
+   size_t count = 1;
+   for (size_t k = 0; k < shape_.size(); k++)
+      count *= shape_[k];
+   size_t offset = header_start + header_length;
+   if (count * word_size_ > file_size - offset)
+      npy_error("Truncated .npy file", file_path);
+   data_ = bytes + offset;
+}
+
+void npy_view::require(char type, size_t word_size, size_t columns) const {
+   bool shape_ok = columns ? (shape_.size() == 2 && shape_[1] == columns) : shape_.size() == 1;
+   if (type_ != type || word_size_ != word_size || !little_endian_ || fortran_order_ || !shape_ok) {
+      std::cerr << "Expected a C ordered " << (columns ? "Nx" + std::to_string(columns) : std::string("N"))
+         << " array of '<" << type << word_size << "' in " << file_.path() << std::endl;
+      exit(1);
+   }
+}
+
+// Version 1.0 header, padded with spaces so that the data starts at a multiple of 64 bytes
+std::string npy_header(char type, size_t word_size, size_t rows, size_t columns) {
+   std::string dict = std::string("{'descr': '") + (word_size == 1 ? '|' : '<') + type + std::to_string(word_size)
+      + "', 'fortran_order': False, 'shape': (" + std::to_string(rows)
+      + (columns ? ", " + std::to_string(columns) + ")" : std::string(",)")) + ", }";
+   size_t length = 10 + dict.size() + 1;
+   dict.append((64 - length % 64) % 64, ' ');
+   dict += '\n';
+
+   std::string header("\x93NUMPY\x01\x00", 8);
+   header += char(dict.size() & 0xff);
+   header += char(dict.size() >> 8);
+   return header + dict;
+}
+
+npy_writer::npy_writer(std::string path, char type, size_t word_size, size_t rows, size_t columns)
+   : npy_writer(path, npy_header(type, word_size, rows, columns), rows * (columns ? columns : 1) * word_size) {
+}
+
+npy_writer::npy_writer(std::string path, const std::string &header, size_t data_size)
+   : file_(path, header.size() + data_size) {
+   std::memcpy(file_.data(), header.data(), header.size());
+   data_ = file_.data() + header.size();
+}
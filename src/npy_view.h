@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_NPY_VIEW_
+#define MASBCPP_NPY_VIEW_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Read-only view of an .npy file that is mapped into memory instead of read into a buffer.
+// The operating system pages the data in when it is first touched and can drop the pages again
+// under memory pressure, since they are backed by the file.
+class npy_view {
+public:
+   // Maps the file, prints an error and exits if it can't be opened or is not a valid .npy file
+   explicit npy_view(std::string path);
+
+   const std::vector<size_t> &shape() const { return shape_; }
+   // numpy type character ('f' for floats, 'i' for signed ints, 'b' for bools) and bytes per element
+   char type() const { return type_; }
+   size_t word_size() const { return word_size_; }
+
+   const void *data() const { return data_; }
+   template <class T>
+   const T *as() const { return static_cast<const T *>(data_); }
+
+   // Exits with an error unless the array holds little endian, C ordered elements of the given type
+   // and size, with the given number of columns (0 for a 1D array)
+   void require(char type, size_t word_size, size_t columns) const;
+
+   npy_view(const npy_view &) = delete;
+   npy_view &operator=(const npy_view &) = delete;
+
+private:
+   file_view file_;
+   std::vector<size_t> shape_;
+   char type_;
+   size_t word_size_;
+   bool fortran_order_, little_endian_;
+   const void *data_; // first element, after the header
+};
+
+// Version 1.0 .npy header for an array of rows x columns elements (columns 0 for a 1D array) of the given
+// numpy type character and size, padded so that the data starts at a multiple of 64 bytes
+std::string npy_header(char type, size_t word_size, size_t rows, size_t columns);
+
+// An .npy file that is created at its final size and mapped into memory for writing, so that threads can
+// fill disjoint parts of the array in place without a staging buffer. The file is complete once the writer
+// is destroyed.
+class npy_writer {
+public:
+   // Creates the file for an array of rows x columns elements (columns 0 for a 1D array) of the given numpy
+   // type character and size. Prints an error and exits if the file can't be created.
+   npy_writer(std::string path, char type, size_t word_size, size_t rows, size_t columns);
+
+   void *data() { return data_; }
+   template <class T>
+   T *as() { return static_cast<T *>(data_); }
+
+   npy_writer(const npy_writer &) = delete;
+   npy_writer &operator=(const npy_writer &) = delete;
+
+private:
+   npy_writer(std::string path, const std::string &header, size_t data_size);
+
+   file_writer file_;
+   void *data_;
+};
+
+#endif
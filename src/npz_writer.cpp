@@ -0,0 +1,260 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "npz_writer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <zlib.h>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include "npy_view.h"
+
+// Uncompressed bytes per independently deflated chunk. Smaller chunks spread better over the threads,
+// but every chunk starts without history, which costs a little compression.
+const size_t chunk_size = 1 << 20;
+// Members from this size on get zip64 sizes. Deflate adds a few bytes per stored block at worst,
+// so the compressed size of a smaller member fits in 32 bits as well.
+const uint64_t zip64_size = 0xf0000000ull;
+const uint32_t zip_max = 0xffffffffu;
+
+inline void npz_error(const std::string &message, const std::string &path) {
+   std::cerr << message << " " << path << std::endl;
+   exit(1);
+}
+
+// Appends the lowest n bytes of v in little endian order
+inline void put(std::string &s, uint64_t v, int n) {
+   for (int i = 0; i < n; i++)
+      s += char((v >> (8 * i)) & 0xff);
+}
+
+// Deflates one chunk without a zlib header. All but the last chunk end with a sync flush, which aligns
+// the output to a byte boundary without ending the stream, so the next chunk can follow directly.
+bool deflate_chunk(const char *data, size_t size, bool last, int level, std::string &out) {
+   z_stream zs;
+   std::memset(&zs, 0, sizeof(zs));
+   if (deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return false;
+
+   out.resize(deflateBound(&zs, uLong(size)) + 16);
+   zs.next_in = (Bytef *)data;
+   zs.avail_in = uInt(size);
+   zs.next_out = (Bytef *)&out[0];
+   zs.avail_out = uInt(out.size());
+   int ret = deflate(&zs, last ? Z_FINISH : Z_SYNC_FLUSH);
+   bool ok = last ? ret == Z_STREAM_END : (ret == Z_OK && zs.avail_in == 0 && zs.avail_out > 0);
+   out.resize(zs.total_out);
+   deflateEnd(&zs);
+   return ok;
+}
+
+npz_writer::npz_writer(std::string path, int level)
+   : path_(path), level_(level), offset_(0), size_(0) {
+   // windows fix
+   std::replace(path_.begin(), path_.end(), '\\', '/');
+
+   file_.open(path_.c_str(), std::ios::binary | std::ios::trunc);
+   if (!file_)
+      npz_error("Could not create file", path_);
+}
+
+npz_writer::~npz_writer() {
+   close();
+}
+
+void *npz_writer::begin_array(const std::string &name, char type, size_t word_size, size_t rows, size_t columns) {
+   std::string header = npy_header(type, word_size, rows, columns);
+   name_ = name + ".npy";
+   size_ = header.size() + rows * (columns ? columns : 1) * word_size;
+   buffer_.reset(new char[size_]);
+   std::memcpy(buffer_.get(), header.data(), header.size());
+   return buffer_.get() + header.size();
+}
+
+void npz_writer::end_array() {
+   member m;
+   m.name = name_;
+   m.crc = uint32_t(crc32(0L, Z_NULL, 0));
+   m.size = size_;
+   m.compressed_size = 0;
+   m.offset = offset_;
+   m.zip64 = m.size >= zip64_size;
+
+   // The sizes and the crc are filled in once the member is written
+   std::string header;
+   put(header, 0x04034b50, 4);
+   put(header, m.zip64 ? 45 : 20, 2); // version needed to extract
+   put(header, 0, 2);                 // flags
+   put(header, 8, 2);                 // deflate
+   put(header, 0, 2);                 // time
+   put(header, (1 << 5) | 1, 2);      // date, 1980-01-01
+   put(header, 0, 4);                 // crc
+   put(header, m.zip64 ? zip_max : 0, 4);
+   put(header, m.zip64 ? zip_max : 0, 4);
+   put(header, m.name.size(), 2);
+   put(header, m.zip64 ? 20 : 0, 2);
+   header += m.name;
+   if (m.zip64) {
+      put(header, 0x0001, 2);
+      put(header, 16, 2);
+      put(header, 0, 8);
+      put(header, 0, 8);
+   }
+   file_.write(header.data(), header.size());
+
+   // Compress a few chunks per thread at a time, so that the compressed data is never held all at once
+   const char *data = buffer_.get();
+   size_t chunks = std::max<size_t>(1, (size_ + chunk_size - 1) / chunk_size);
+   int threads = 1;
+#ifdef WITH_OPENMP
+   threads = omp_get_max_threads();
+#endif
+   size_t group = 4 * size_t(threads);
+   std::vector<std::string> out(group);
+   std::vector<uLong> crcs(group);
+   bool failed = false;
+   for (size_t first = 0; first < chunks; first += group) {
+      int count = int(std::min(group, chunks - first));
+#pragma omp parallel for schedule(dynamic)
+      for (int k = 0; k < count; k++) {
+         size_t begin = (first + k) * chunk_size, size = std::min(chunk_size, size_ - begin);
+         if (!deflate_chunk(data + begin, size, first + k + 1 == chunks, level_, out[k]))
+            failed = true;
+         crcs[k] = crc32(0L, (const Bytef *)data + begin, uInt(size));
+      }
+      if (failed)
+         npz_error("Could not compress " + name_ + " for", path_);
+
+      for (int k = 0; k < count; k++) {
+         size_t begin = (first + k) * chunk_size, size = std::min(chunk_size, size_ - begin);
+         file_.write(out[k].data(), out[k].size());
+         m.crc = uint32_t(crc32_combine(m.crc, crcs[k], z_off_t(size)));
+         m.compressed_size += out[k].size();
+      }
+   }
+   buffer_.reset();
+
+   std::string sizes;
+   put(sizes, m.crc, 4);
+   if (m.zip64) {
+      put(sizes, zip_max, 4);
+      put(sizes, zip_max, 4);
+   } else {
+      put(sizes, m.compressed_size, 4);
+      put(sizes, m.size, 4);
+   }
+   file_.seekp(std::streamoff(m.offset + 14));
+   file_.write(sizes.data(), sizes.size());
+   if (m.zip64) {
+      std::string extra;
+      put(extra, m.size, 8);
+      put(extra, m.compressed_size, 8);
+      file_.seekp(std::streamoff(m.offset + 30 + m.name.size() + 4));
+      file_.write(extra.data(), extra.size());
+   }
+   file_.seekp(0, std::ios::end);
+   if (!file_)
+      npz_error("Could not write", path_);
+
+   offset_ += header.size() + m.compressed_size;
+   members_.push_back(m);
+}
+
+void npz_writer::close() {
+   if (!file_.is_open())
+      return;
+
+   std::string directory;
+   for (const member &m : members_) {
+      bool far = m.offset >= zip_max;
+      std::string extra;
+      if (m.zip64) {
+         put(extra, m.size, 8);
+         put(extra, m.compressed_size, 8);
+      }
+      if (far)
+         put(extra, m.offset, 8);
+
+      put(directory, 0x02014b50, 4);
+      put(directory, 45, 2);                         // version made by
+      put(directory, m.zip64 || far ? 45 : 20, 2);   // version needed to extract
+      put(directory, 0, 2);
+      put(directory, 8, 2);
+      put(directory, 0, 2);
+      put(directory, (1 << 5) | 1, 2);
+      put(directory, m.crc, 4);
+      put(directory, m.zip64 ? zip_max : m.compressed_size, 4);
+      put(directory, m.zip64 ? zip_max : m.size, 4);
+      put(directory, m.name.size(), 2);
+      put(directory, extra.empty() ? 0 : extra.size() + 4, 2);
+      put(directory, 0, 2); // comment length
+      put(directory, 0, 2); // disk
+      put(directory, 0, 2); // internal attributes
+      put(directory, 0, 4); // external attributes
+      put(directory, far ? zip_max : m.offset, 4);
+      directory += m.name;
+      if (!extra.empty()) {
+         put(directory, 0x0001, 2);
+         put(directory, extra.size(), 2);
+         directory += extra;
+      }
+   }
+
+   uint64_t directory_offset = offset_, directory_size = directory.size();
+   if (directory_offset >= zip_max || members_.size() >= 0xffff) {
+      // zip64 end of central directory record and its locator
+      put(directory, 0x06064b50, 4);
+      put(directory, 44, 8);
+      put(directory, 45, 2);
+      put(directory, 45, 2);
+      put(directory, 0, 4);
+      put(directory, 0, 4);
+      put(directory, members_.size(), 8);
+      put(directory, members_.size(), 8);
+      put(directory, directory_size, 8);
+      put(directory, directory_offset, 8);
+      put(directory, 0x07064b50, 4);
+      put(directory, 0, 4);
+      put(directory, directory_offset + directory_size, 8);
+      put(directory, 1, 4);
+   }
+   put(directory, 0x06054b50, 4);
+   put(directory, 0, 2);
+   put(directory, 0, 2);
+   put(directory, std::min<size_t>(members_.size(), 0xffff), 2);
+   put(directory, std::min<size_t>(members_.size(), 0xffff), 2);
+   put(directory, std::min<uint64_t>(directory_size, zip_max), 4);
+   put(directory, std::min<uint64_t>(directory_offset, zip_max), 4);
+   put(directory, 0, 2); // comment length
+
+   file_.write(directory.data(), directory.size());
+   file_.close();
+   if (!file_)
+      npz_error("Could not write", path_);
+}
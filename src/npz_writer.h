@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_NPZ_WRITER_
+#define MASBCPP_NPZ_WRITER_
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Zip archive of deflated .npy members, as written by numpy.savez_compressed. Each array is cut into
+// chunks that all threads compress independently (like pigz does), the chunks end on a byte boundary
+// so that they join into one regular deflate stream that any zip reader can inflate. Members and
+// archives over 4 GB get zip64 records.
+class npz_writer {
+public:
+   // Creates the archive, prints an error and exits if it can't be created
+   explicit npz_writer(std::string path, int level = 6);
+   ~npz_writer();
+
+   // Starts the member name.npy for an array of rows x columns elements (columns 0 for a 1D array) of
+   // the given numpy type character and size. Returns the buffer for the elements, which is compressed
+   // into the archive by end_array().
+   void *begin_array(const std::string &name, char type, size_t word_size, size_t rows, size_t columns);
+   void end_array();
+
+   // Writes the central directory, the archive is complete afterwards
+   void close();
+
+   npz_writer(const npz_writer &) = delete;
+   npz_writer &operator=(const npz_writer &) = delete;
+
+private:
+   struct member {
+      std::string name;
+      uint32_t crc;
+      uint64_t size, compressed_size, offset;
+      bool zip64;
+   };
+
+   std::string path_;
+   int level_;
+   std::ofstream file_;
+   uint64_t offset_;
+   std::vector<member> members_;
+
+   // the .npy file of the current member
+   std::string name_;
+   std::unique_ptr<char[]> buffer_;
+   size_t size_;
+};
+
+#endif
@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "oct_normals.h"
+
+#include <algorithm>
+#include <cmath>
+
+// Octahedral coordinates of (x, y, z) as integers in [-max, max], or false for a vector without a direction.
+// The nearest integers are not always the closest direction, so the four around the exact coordinates are
+// decoded and the one closest to the normal is taken.
+bool oct_quantize(Scalar x, Scalar y, Scalar z, int max, int &qu, int &qv) {
+   if (!is_finite(x) || !is_finite(y) || !is_finite(z))
+      return false;
+   Scalar s = std::abs(x) + std::abs(y) + std::abs(z);
+   if (!(s > 0))
+      return false;
+   Scalar u = x / s, v = y / s;
+   if (z < 0) {
+      Scalar fu = (1 - std::abs(v)) * (u >= 0 ? 1 : -1);
+      v = (1 - std::abs(u)) * (v >= 0 ? 1 : -1);
+      u = fu;
+   }
+
+   Vector3 n = Vector3(x, y, z) / std::sqrt(x * x + y * y + z * z);
+   int fu = int(std::floor(u * max)), fv = int(std::floor(v * max));
+   Scalar best = -2;
+   for (int du = 0; du < 2; du++)
+      for (int dv = 0; dv < 2; dv++) {
+         int cu = std::min(max, std::max(-max, fu + du)), cv = std::min(max, std::max(-max, fv + dv));
+         Scalar dot = oct_direction(Scalar(cu) / max, Scalar(cv) / max).dot(n);
+         if (dot > best) {
+            best = dot;
+            qu = cu;
+            qv = cv;
+         }
+      }
+   return true;
+}
+
+uint32_t oct_encode32(Scalar x, Scalar y, Scalar z) {
+   int qu, qv;
+   if (!oct_quantize(x, y, z, 32767, qu, qv))
+      return 0x80008000u;
+   return uint32_t(uint16_t(qu)) | (uint32_t(uint16_t(qv)) << 16);
+}
+
+uint16_t oct_encode16(Scalar x, Scalar y, Scalar z) {
+   int qu, qv;
+   if (!oct_quantize(x, y, z, 127, qu, qv))
+      return 0x8080u;
+   return uint16_t(uint8_t(qu) | (uint8_t(qv) << 8));
+}
+
+void oct_normals::clear() {
+   bits = 0;
+   oct32.clear();
+   oct16.clear();
+}
+
+void oct_normals::assign(const NormalCloud &normals, int encoding_bits) {
+   clear();
+   bits = encoding_bits;
+   if (bits == 32)
+      oct32.resize(normals.size());
+   else
+      oct16.resize(normals.size());
+
+#pragma omp parallel for
+   for (Index i = 0; i < normals.size(); i++) {
+      const Normal &nm = normals[i];
+      if (bits == 32)
+         oct32[i] = oct_encode32(nm.normal_x, nm.normal_y, nm.normal_z);
+      else
+         oct16[i] = oct_encode16(nm.normal_x, nm.normal_y, nm.normal_z);
+   }
+}
@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_OCT_NORMALS_
+#define MASBCPP_OCT_NORMALS_
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "types.h"
+
+// Unit normals in octahedral encoding: the direction is projected onto the octahedron |x|+|y|+|z| = 1, its
+// lower half is folded over the upper half, and the two remaining coordinates are stored as normalized
+// signed integers. 32 bits per normal (2 x 16) keep the direction within 0.01 degrees, 16 bits (2 x 8)
+// within 0.7 degrees, compared to the 32 bytes of a pcl::Normal. Normals that are not finite, as
+// the normal estimation gives for degenerate neighbourhoods, get a code of their own and decode to nan.
+struct oct_normals {
+   int bits = 0; // 16 or 32, 0 when empty
+   std::vector<uint32_t> oct32;
+   std::vector<uint16_t> oct16;
+
+   size_t size() const { return bits == 32 ? oct32.size() : oct16.size(); }
+   bool empty() const { return size() == 0; }
+   void clear();
+
+   // Encodes normals with the given number of bits
+   void assign(const NormalCloud &normals, int bits);
+
+   inline Vector3 operator[](size_t i) const;
+};
+
+uint32_t oct_encode32(Scalar x, Scalar y, Scalar z);
+uint16_t oct_encode16(Scalar x, Scalar y, Scalar z);
+
+// The unit vector for the octahedral coordinates u and v (in [-1, 1])
+inline Vector3 oct_direction(Scalar u, Scalar v) {
+   Scalar z = 1 - std::abs(u) - std::abs(v);
+   if (z < 0) {
+      Scalar fu = (1 - std::abs(v)) * (u >= 0 ? 1 : -1);
+      v = (1 - std::abs(u)) * (v >= 0 ? 1 : -1);
+      u = fu;
+   }
+   return Vector3(u, v, z).normalized();
+}
+
+inline Vector3 oct_decode32(uint32_t w) {
+   int16_t u = int16_t(w & 0xffff), v = int16_t(w >> 16);
+   if (u == -32768)
+      return Vector3::Constant(std::numeric_limits<Scalar>::quiet_NaN());
+   return oct_direction(u * (Scalar(1) / 32767), v * (Scalar(1) / 32767));
+}
+
+inline Vector3 oct_decode16(uint16_t w) {
+   int8_t u = int8_t(w & 0xff), v = int8_t(w >> 8);
+   if (u == -128)
+      return Vector3::Constant(std::numeric_limits<Scalar>::quiet_NaN());
+   return oct_direction(u * (Scalar(1) / 127), v * (Scalar(1) / 127));
+}
+
+inline Vector3 oct_normals::operator[](size_t i) const {
+   return bits == 32 ? oct_decode32(oct32[i]) : oct_decode16(oct16[i]);
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "quantized_cloud.h"
+
+void quantized_cloud::center(const int64_t lo[3], const int64_t hi[3]) {
+   for (int k = 0; k < 3; k++)
+      origin[k] = (lo[k] + hi[k]) / 2;
+   exact = covers(lo, hi);
+}
+
+bool quantized_cloud::covers(const int64_t lo[3], const int64_t hi[3]) const {
+   for (int k = 0; k < 3; k++)
+      if (origin[k] - lo[k] >= max_exact_steps || hi[k] - origin[k] >= max_exact_steps)
+         return false;
+   return true;
+}
@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_QUANTIZED_CLOUD_
+#define MASBCPP_QUANTIZED_CLOUD_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+// A point in the integer coordinates of a quantized_cloud
+struct QPoint {
+   int32_t x, y, z;
+};
+
+// How points stored the way LAS stores them map to the float coordinates of the processing. In the file
+// they are integers with a per-dataset scale and offset, so that georeferenced coordinates (RD, UTM) stay
+// exact. Only the floats are kept, relative to origin, an integer point in the middle of the points. Those
+// round once, so quantize() gets the integers back exactly within max_exact_steps of origin.
+struct quantized_cloud {
+   double scale[3] = { 1, 1, 1 };
+   double offset[3] = { 0, 0, 0 };
+   int64_t origin[3] = { 0, 0, 0 };
+   // Set when the points were read from a quantized format
+   bool active = false;
+   // Whether all points lie within max_exact_steps of origin
+   bool exact = true;
+
+   double world(int64_t q, int k) const { return q * scale[k] + offset[k]; }
+
+   // The float coordinate of integer q along axis k. The difference is taken in integers, so the float only
+   // rounds once and is as precise as the distance to origin allows.
+   float local(int64_t q, int k) const { return float(double(q - origin[k]) * scale[k]); }
+   // The integer coordinate that local() turned into v
+   int64_t quantize(float v, int k) const { return origin[k] + std::llround(double(v) / scale[k]); }
+
+   // Sets origin to the middle of the integer bounding box lo - hi and exact accordingly
+   void center(const int64_t lo[3], const int64_t hi[3]);
+   // Whether the bounding box lies within max_exact_steps of origin
+   bool covers(const int64_t lo[3], const int64_t hi[3]) const;
+};
+
+// A float has a 24 bit significand, so local() is off by less than half a step up to 2^23 steps from origin
+const int64_t max_exact_steps = int64_t(1) << 23;
+
+#endif
@@ -0,0 +1,221 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "sb_kernels.h"
+
+#include <cmath>
+#include <cstdint>
+
+// The vector kernels are compiled for their instruction set with function attributes and picked at
+// runtime, so the binaries still run on CPUs without AVX
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SB_KERNELS_X86
+#endif
+
+denoise_thresholds make_denoise_thresholds(double denoise_planar, double denoise_preserve) {
+   // acos returns at most pi, so every separation angle is below a threshold of pi or more
+   denoise_thresholds t;
+   t.planar = denoise_planar > 0;
+   t.preserve = denoise_preserve > 0;
+   t.cos_planar = denoise_planar < M_PI ? Scalar(std::cos(denoise_planar)) : Scalar(-2);
+   t.cos_preserve = denoise_preserve < M_PI ? Scalar(std::cos(denoise_preserve)) : Scalar(-2);
+   return t;
+}
+
+static void step_scalar(const denoise_thresholds &denoise, unsigned int iteration_limit, sb_batch &b, size_t begin, size_t end) {
+   for (size_t i = begin; i < end; i++) {
+      // radius of the ball that touches p and q and whose center falls on the normal n from p
+      Scalar vx = b.px[i] - b.qx[i], vy = b.py[i] - b.qy[i], vz = b.pz[i] - b.qz[i];
+      Scalar d = std::sqrt(vx * vx + vy * vy + vz * vz);
+      Scalar cos_theta = (b.nx[i] * vx + b.ny[i] * vy + b.nz[i] * vz) / d;
+      Scalar r = d / (2 * cos_theta);
+      Scalar cx = b.px[i] - b.nx[i] * r, cy = b.py[i] - b.ny[i] * r, cz = b.pz[i] - b.nz[i] * r;
+      b.r[i] = r;
+      b.cx[i] = cx;
+      b.cy[i] = cy;
+      b.cz[i] = cz;
+
+      bool stop = !(is_finite(cx) && is_finite(cy) && is_finite(cz));
+      if (!stop && (denoise.planar || denoise.preserve)) {
+         // cosine of the separation angle between p and q seen from the center
+         Scalar ux = b.px[i] - cx, uy = b.py[i] - cy, uz = b.pz[i] - cz;
+         Scalar wx = b.qx[i] - cx, wy = b.qy[i] - cy, wz = b.qz[i] - cz;
+         Scalar a = (ux * wx + uy * wy + uz * wz) / (std::sqrt(ux * ux + uy * uy + uz * uz) * std::sqrt(wx * wx + wy * wy + wz * wz));
+         if (b.j[i] == 0)
+            stop = denoise.planar && a > denoise.cos_planar;
+         else
+            stop = denoise.preserve && a > denoise.cos_preserve && r > d;
+      }
+      if (b.j[i] > int(iteration_limit))
+         stop = true;
+      b.stop[i] = stop;
+   }
+}
+
+static void step_scalar_all(const denoise_thresholds &denoise, unsigned int iteration_limit, sb_batch &b, size_t count) {
+   step_scalar(denoise, iteration_limit, b, 0, count);
+}
+
+#ifdef SB_KERNELS_X86
+// 8 balls per instruction, the same operations in the same order as step_scalar()
+__attribute__((target("avx2")))
+static inline __m256 dot_avx2(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) {
+   return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i nonfinite_avx2(__m256 v) {
+   const __m256i exponent = _mm256_set1_epi32(0x7f800000);
+   return _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_castps_si256(v), exponent), exponent);
+}
+
+__attribute__((target("avx2")))
+static void step_avx2(const denoise_thresholds &denoise, unsigned int iteration_limit, sb_batch &b, size_t count) {
+   const __m256 two = _mm256_set1_ps(2);
+   const __m256 cos_planar = _mm256_set1_ps(denoise.cos_planar), cos_preserve = _mm256_set1_ps(denoise.cos_preserve);
+   const __m256i zero = _mm256_setzero_si256(), limit = _mm256_set1_epi32(int(iteration_limit));
+
+   size_t i = 0;
+   for (; i + 8 <= count; i += 8) {
+      __m256 px = _mm256_loadu_ps(b.px + i), py = _mm256_loadu_ps(b.py + i), pz = _mm256_loadu_ps(b.pz + i);
+      __m256 nx = _mm256_loadu_ps(b.nx + i), ny = _mm256_loadu_ps(b.ny + i), nz = _mm256_loadu_ps(b.nz + i);
+      __m256 qx = _mm256_loadu_ps(b.qx + i), qy = _mm256_loadu_ps(b.qy + i), qz = _mm256_loadu_ps(b.qz + i);
+      __m256i j = _mm256_loadu_si256((const __m256i *)(b.j + i));
+
+      __m256 vx = _mm256_sub_ps(px, qx), vy = _mm256_sub_ps(py, qy), vz = _mm256_sub_ps(pz, qz);
+      __m256 d = _mm256_sqrt_ps(dot_avx2(vx, vy, vz, vx, vy, vz));
+      __m256 cos_theta = _mm256_div_ps(dot_avx2(nx, ny, nz, vx, vy, vz), d);
+      __m256 r = _mm256_div_ps(d, _mm256_mul_ps(two, cos_theta));
+      __m256 cx = _mm256_sub_ps(px, _mm256_mul_ps(nx, r));
+      __m256 cy = _mm256_sub_ps(py, _mm256_mul_ps(ny, r));
+      __m256 cz = _mm256_sub_ps(pz, _mm256_mul_ps(nz, r));
+      _mm256_storeu_ps(b.r + i, r);
+      _mm256_storeu_ps(b.cx + i, cx);
+      _mm256_storeu_ps(b.cy + i, cy);
+      _mm256_storeu_ps(b.cz + i, cz);
+
+      __m256i stop = _mm256_or_si256(nonfinite_avx2(cx), _mm256_or_si256(nonfinite_avx2(cy), nonfinite_avx2(cz)));
+      if (denoise.planar || denoise.preserve) {
+         __m256 ux = _mm256_sub_ps(px, cx), uy = _mm256_sub_ps(py, cy), uz = _mm256_sub_ps(pz, cz);
+         __m256 wx = _mm256_sub_ps(qx, cx), wy = _mm256_sub_ps(qy, cy), wz = _mm256_sub_ps(qz, cz);
+         __m256 a = _mm256_div_ps(dot_avx2(ux, uy, uz, wx, wy, wz),
+            _mm256_mul_ps(_mm256_sqrt_ps(dot_avx2(ux, uy, uz, ux, uy, uz)), _mm256_sqrt_ps(dot_avx2(wx, wy, wz, wx, wy, wz))));
+         __m256i first = _mm256_cmpeq_epi32(j, zero);
+         if (denoise.planar)
+            stop = _mm256_or_si256(stop, _mm256_and_si256(first, _mm256_castps_si256(_mm256_cmp_ps(a, cos_planar, _CMP_GT_OQ))));
+         if (denoise.preserve)
+            stop = _mm256_or_si256(stop, _mm256_andnot_si256(first, _mm256_castps_si256(
+               _mm256_and_ps(_mm256_cmp_ps(a, cos_preserve, _CMP_GT_OQ), _mm256_cmp_ps(r, d, _CMP_GT_OQ)))));
+      }
+      stop = _mm256_or_si256(stop, _mm256_cmpgt_epi32(j, limit));
+      _mm256_storeu_si256((__m256i *)(b.stop + i), _mm256_srli_epi32(stop, 31));
+   }
+   step_scalar(denoise, iteration_limit, b, i, count);
+}
+
+// 16 balls per instruction
+__attribute__((target("avx512f")))
+static inline __m512 dot_avx512(__m512 ax, __m512 ay, __m512 az, __m512 bx, __m512 by, __m512 bz) {
+   return _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ax, bx), _mm512_mul_ps(ay, by)), _mm512_mul_ps(az, bz));
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask16 nonfinite_avx512(__m512 v) {
+   const __m512i exponent = _mm512_set1_epi32(0x7f800000);
+   return _mm512_cmpeq_epi32_mask(_mm512_and_si512(_mm512_castps_si512(v), exponent), exponent);
+}
+
+__attribute__((target("avx512f")))
+static void step_avx512(const denoise_thresholds &denoise, unsigned int iteration_limit, sb_batch &b, size_t count) {
+   const __m512 two = _mm512_set1_ps(2);
+   const __m512 cos_planar = _mm512_set1_ps(denoise.cos_planar), cos_preserve = _mm512_set1_ps(denoise.cos_preserve);
+   const __m512i zero = _mm512_setzero_si512(), limit = _mm512_set1_epi32(int(iteration_limit));
+
+   size_t i = 0;
+   for (; i + 16 <= count; i += 16) {
+      __m512 px = _mm512_loadu_ps(b.px + i), py = _mm512_loadu_ps(b.py + i), pz = _mm512_loadu_ps(b.pz + i);
+      __m512 nx = _mm512_loadu_ps(b.nx + i), ny = _mm512_loadu_ps(b.ny + i), nz = _mm512_loadu_ps(b.nz + i);
+      __m512 qx = _mm512_loadu_ps(b.qx + i), qy = _mm512_loadu_ps(b.qy + i), qz = _mm512_loadu_ps(b.qz + i);
+      __m512i j = _mm512_loadu_si512(b.j + i);
+
+      __m512 vx = _mm512_sub_ps(px, qx), vy = _mm512_sub_ps(py, qy), vz = _mm512_sub_ps(pz, qz);
+      __m512 d = _mm512_sqrt_ps(dot_avx512(vx, vy, vz, vx, vy, vz));
+      __m512 cos_theta = _mm512_div_ps(dot_avx512(nx, ny, nz, vx, vy, vz), d);
+      __m512 r = _mm512_div_ps(d, _mm512_mul_ps(two, cos_theta));
+      __m512 cx = _mm512_sub_ps(px, _mm512_mul_ps(nx, r));
+      __m512 cy = _mm512_sub_ps(py, _mm512_mul_ps(ny, r));
+      __m512 cz = _mm512_sub_ps(pz, _mm512_mul_ps(nz, r));
+      _mm512_storeu_ps(b.r + i, r);
+      _mm512_storeu_ps(b.cx + i, cx);
+      _mm512_storeu_ps(b.cy + i, cy);
+      _mm512_storeu_ps(b.cz + i, cz);
+
+      __mmask16 stop = nonfinite_avx512(cx) | nonfinite_avx512(cy) | nonfinite_avx512(cz);
+      if (denoise.planar || denoise.preserve) {
+         __m512 ux = _mm512_sub_ps(px, cx), uy = _mm512_sub_ps(py, cy), uz = _mm512_sub_ps(pz, cz);
+         __m512 wx = _mm512_sub_ps(qx, cx), wy = _mm512_sub_ps(qy, cy), wz = _mm512_sub_ps(qz, cz);
+         __m512 a = _mm512_div_ps(dot_avx512(ux, uy, uz, wx, wy, wz),
+            _mm512_mul_ps(_mm512_sqrt_ps(dot_avx512(ux, uy, uz, ux, uy, uz)), _mm512_sqrt_ps(dot_avx512(wx, wy, wz, wx, wy, wz))));
+         __mmask16 first = _mm512_cmpeq_epi32_mask(j, zero);
+         if (denoise.planar)
+            stop |= first & _mm512_cmp_ps_mask(a, cos_planar, _CMP_GT_OQ);
+         if (denoise.preserve)
+            stop |= ~first & _mm512_cmp_ps_mask(a, cos_preserve, _CMP_GT_OQ) & _mm512_cmp_ps_mask(r, d, _CMP_GT_OQ);
+      }
+      stop |= _mm512_cmpgt_epi32_mask(j, limit);
+      _mm512_storeu_si512(b.stop + i, _mm512_maskz_set1_epi32(stop, 1));
+   }
+   step_scalar(denoise, iteration_limit, b, i, count);
+}
+#endif
+
+typedef void(*step_kernel)(const denoise_thresholds &, unsigned int, sb_batch &, size_t);
+
+struct kernel_choice {
+   step_kernel step;
+   const char *name;
+};
+
+static kernel_choice select_kernel() {
+#ifdef SB_KERNELS_X86
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f"))
+      return{ step_avx512, "AVX-512" };
+   if (__builtin_cpu_supports("avx2"))
+      return{ step_avx2, "AVX2" };
+#endif
+   return{ step_scalar_all, "scalar" };
+}
+
+static const kernel_choice &kernel() {
+   static const kernel_choice choice = select_kernel();
+   return choice;
+}
+
+void sb_step_batch(const denoise_thresholds &denoise, unsigned int iteration_limit, sb_batch &batch, size_t count) {
+   kernel().step(denoise, iteration_limit, batch, count);
+}
+
+const char *sb_kernel_name() {
+   return kernel().name;
+}
@@ -0,0 +1,63 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_SB_KERNELS_
+#define MASBCPP_SB_KERNELS_
+
+#include <cstddef>
+
+#include "types.h"
+
+// The denoise thresholds as cosines of the separation angle. A ball is rejected when the cosine of its
+// separation angle is larger than the threshold, which saves an acos per iteration.
+struct denoise_thresholds {
+   bool planar, preserve;
+   Scalar cos_planar, cos_preserve;
+};
+
+// Converts the denoise_planar and denoise_preserve angles (in radians) of ma_parameters
+denoise_thresholds make_denoise_thresholds(double denoise_planar, double denoise_preserve);
+
+// One shrinking ball iteration for a batch of balls, in structure of arrays layout. Each lane holds the
+// point p, its normal n, the point q found closest to the current ball center and the iteration count j.
+struct sb_batch {
+   static const size_t capacity = 64;
+
+   Scalar px[capacity], py[capacity], pz[capacity];
+   Scalar nx[capacity], ny[capacity], nz[capacity];
+   Scalar qx[capacity], qy[capacity], qz[capacity];
+   int j[capacity];
+
+   // results: radius and center of the ball through p and q, and whether the iterations stop here
+   // because that ball is degenerate, rejected by the denoising or over the iteration limit
+   Scalar r[capacity];
+   Scalar cx[capacity], cy[capacity], cz[capacity];
+   int stop[capacity];
+};
+
+// Runs the iteration for the first count lanes of batch, with the widest instruction set the CPU supports
+void sb_step_batch(const denoise_thresholds &denoise, unsigned int iteration_limit, sb_batch &batch, size_t count);
+
+// Name of the instruction set sb_step_batch() uses on this CPU
+const char *sb_kernel_name();
+
+#endif
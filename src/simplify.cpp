@@ -30,6 +30,8 @@ SOFTWARE.
 // typedefs
 #include "simplify_processing.h"
 #include "io.h"
+#include "morton.h"
+#include "xyz_writer.h"
 
 
 
@@ -53,7 +55,13 @@ int main(int argc, char **argv)
         TCLAP::SwitchArg innerSwitch("i","inner","Compute LFS using only interior MAT points.", cmd, false);
         TCLAP::SwitchArg squaredSwitch("s","squared","Use squared LFS during simplification.", cmd, false);
         TCLAP::SwitchArg nolfsSwitch("d","no-lfs","Don't recompute lfs.'", cmd, false);
+        TCLAP::SwitchArg mortonSwitch("z","morton","Sort the points in Morton (Z-order) before processing so that nearby points are processed together, which is faster for large point clouds. The outputs keep the input order.", cmd, false);
         
+        TCLAP::ValueArg<std::string> lasArg("","las","Read the points from this LAS file instead of 'coords.npy', relative to the center of their bounding box (written to 'origin.npy').",false,"","las file", cmd);
+        TCLAP::ValueArg<std::string> lasOutArg("","las_out","Write the points that are kept by the simplification, with all their attributes, from the --las file to this LAS file.",false,"","las file", cmd);
+        TCLAP::ValueArg<std::string> plyArg("","ply","Read the points, MAT points and q indices from the vertices of this binary PLY file instead of the input directory.",false,"","ply file", cmd);
+        TCLAP::ValueArg<std::string> plyOutArg("","ply_out","Also write the points, lfs and decimate_lfs as vertices of this binary PLY file.",false,"","ply file", cmd);
+        TCLAP::ValueArg<std::string> npzArg("","npz","Write the lfs and decimate_lfs arrays into this zip compressed .npz archive instead of separate .npy files in the output directory.",false,"","npz file", cmd);
         TCLAP::ValueArg<std::string> outputXYZArg("a","xyz","output filtered points to plain .xyz text file",false,"lfs_simp.xyz","string", cmd);
 
         cmd.parse(argc,argv);
@@ -86,11 +94,21 @@ int main(int argc, char **argv)
         input_params.coords = true;
         input_params.ma_coords = true;
         input_params.ma_qidx = true;
+        if(input_parameters.only_inner){
+           input_params.sides = MA_INNER;
+        }
         if(!input_parameters.compute_lfs){
            input_params.lfs = true;
         }
 
-        npy2madata(inputArg.getValue(), madata, input_params);
+        if(lasArg.isSet()){
+           las2madata(lasArg.getValue(), madata);
+           input_params.coords = false;
+        }
+        if(plyArg.isSet())
+           ply2madata(plyArg.getValue(), madata, input_params);
+        else
+           npy2madata(inputArg.getValue(), madata, input_params);
 
         if(input_parameters.compute_lfs)
         {
@@ -98,13 +116,17 @@ int main(int argc, char **argv)
         }
         madata.mask.resize(madata.coords->size());
 
+        if (mortonSwitch.getValue())
+           morton_sort(madata);
+
 	    {
           // Perform the actual processing
           simplify_lfs(input_parameters, madata);
+          restore_order(madata);
           
           // count number of remaining points
-          unsigned int cnt(0);
-          for( int i=0; i<madata.coords->size(); i++ )
+          size_t cnt(0);
+          for( size_t i=0; i<madata.coords->size(); i++ )
                 if( madata.mask[i] ) cnt++;
           std::cout << cnt << " out of " << madata.coords->size() << " points remaining [" << int(100*float(cnt)/madata.coords->size()) << "%]" << std::endl;
 
@@ -112,10 +134,23 @@ int main(int argc, char **argv)
           io_parameters output_params = {};
           output_params.lfs = true;
           output_params.mask = true;
-          madata2npy(output_path, madata, output_params);
+          if (npzArg.isSet())
+             madata2npz(npzArg.getValue(), madata, output_params);
+          else
+             madata2npy(output_path, madata, output_params);
+          if(plyOutArg.isSet()){
+             output_params.coords = true;
+             madata2ply(plyOutArg.getValue(), madata, output_params);
+          }
+
+          if(lasOutArg.isSet()){
+             if(!lasArg.isSet())
+                throw TCLAP::ArgException("needs a --las input file", "las_out");
+             write_las_subset(lasArg.getValue(), lasOutArg.getValue(), madata.mask);
+          }
         }
 
-        if( true || outputXYZArg.isSet() ){
+        if( outputXYZArg.isSet() ){
             /*
             std::string outFile_bounds = outputXYZArg.getValue();
             outFile_bounds.append(".bounds");
@@ -129,24 +164,11 @@ int main(int argc, char **argv)
             ofs_bounds.close();
             */
 
-            std::string outFile_xyz = outputXYZArg.getValue();
-            std::replace(outFile_xyz.begin(), outFile_xyz.end(), '\\', '/');
-            std::ofstream ofs(outFile_xyz.c_str());
-            //ofs <<std::setprecision(2)<<std::fixed;
-            
-            // many pointcloud xyz readers prefer a "header" line.
-            ofs << "x y z" << std::endl;
-
-            for( int i=0; i<madata.coords->size(); i++ ) {
-                if( madata.mask[i] ){
-                    ofs << (*madata.coords)[i].x;
-                    ofs << " " << (*madata.coords)[i].y;
-                    ofs << " " << (*madata.coords)[i].z;
-                ofs << std::endl;
-                }
-            }
-            
-            ofs.close();
+            // points read in world coordinates are also written in them
+            if (!madata.quantized.active)
+               write_xyz(outputXYZArg.getValue(), *madata.coords, madata.mask);
+            else
+               write_xyz(outputXYZArg.getValue(), *madata.coords, madata.quantized, madata.mask);
         }
 	} catch (TCLAP::ArgException &e) { std::cerr << "Error: " << e.error() << " for " << e.argId() << std::endl; }
 
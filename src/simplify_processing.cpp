@@ -20,6 +20,7 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <algorithm>
 #include <limits>
 #include <random>
 
@@ -65,23 +66,27 @@ typedef std::chrono::high_resolution_clock Clock;
 
 
 
-bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only_inner = true)
+bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only_inner)
 {
 #ifdef VERBOSEPRINT
    auto start_time = Clock::now();
 #endif
 
-   size_t N = 2 * madata.coords->size();
-   if (only_inner) {
+   size_t N = ma_size(madata);
+   if (only_inner && madata.sides != MA_INNER) {
+      if (madata.sides == MA_OUTER)
+         return false;
       N = madata.coords->size();
       (*madata.ma_coords).resize(N); // HACK this will destroy permanently the exterior ma_coords!
    }
    // compute bisector and filter .. rebuild kdtree .. compute lfs .. compute grid .. thin each cell
 
-   int count = 0;
-   Vector3List ma_bisec(N);
+   size_t count = 0;
+   // Balls that kept the initial radius have no second point and get a zero bisector, any ball with
+   // one of them among its neighbours is rejected
+   Vector3List ma_bisec(N, Vector3::Zero());
    //madata.ma_bisec = &ma_bisec;
-   for (int i = 0; i < N; i++) {
+   for (Index i = 0; i < N; i++) {
       if (madata.ma_qidx[i] != -1) {
          Vector3 f1 = (*madata.coords)[i%madata.coords->size()].getVector3fMap() - (*madata.ma_coords)[i].getVector3fMap();
          Vector3 f2 = (*madata.coords)[madata.ma_qidx[i]].getVector3fMap() - (*madata.ma_coords)[i].getVector3fMap();
@@ -100,11 +105,21 @@ bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only
    if (count == 0)
       return false;
 
+   // All the balls with a finite center, including those that kept the initial radius
+   std::vector<Index> ma_indices;
+   ma_indices.reserve(N);
+
    count = 0;
    std::vector<bool> bisec_mask(N);
    {
-      pcl::search::KdTree<Point>::Ptr kd_tree(new pcl::search::KdTree<Point>());
-      kd_tree->setInputCloud(madata.ma_coords);
+      for (Index i = 0; i < N; i++) {
+         const Point &c = (*madata.ma_coords)[i];
+         if (is_finite(c.x) && is_finite(c.y) && is_finite(c.z))
+            ma_indices.push_back(i);
+      }
+
+      flat_kdtree::Ptr kd_tree(new flat_kdtree());
+      kd_tree->setInputCloud(madata.ma_coords, ma_indices);
 #ifdef VERBOSEPRINT
       auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
       std::cout << "Constructed kd-tree in " << elapsed_time.count() << " ms" << std::endl;
@@ -112,17 +127,17 @@ bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only
 #endif
 
       // Results from our search
-      std::vector<int> k_indices(bisec_k);
+      std::vector<Index> k_indices(bisec_k);
       std::vector<Scalar> k_distances(bisec_k);
 
-#pragma omp parallel for private(k_indices, k_distances)
-      for (int i = 0; i < N; i++) {
+#pragma omp parallel for firstprivate(k_indices, k_distances)
+      for (Index i = 0; i < N; i++) {
          bisec_mask[i] = false;
          if (madata.ma_qidx[i] != -1) {
-            kd_tree->nearestKSearch((*madata.ma_coords)[i], bisec_k, k_indices, k_distances); // find closest point to c
+            int found = kd_tree->nearest_k((*madata.ma_coords)[i].getVector3fMap(), bisec_k, &k_indices[0], &k_distances[0]); // find closest point to c
 
             float bisec_angle, max_bisec_angle = 0;
-            for (int j = 1; j < k_indices.size(); j++){
+            for (int j = 1; j < found; j++){
                   bisec_angle = std::acos(ma_bisec[k_indices[j]].dot(ma_bisec[i]));
                   if (bisec_angle > max_bisec_angle)
                         max_bisec_angle = bisec_angle;
@@ -150,7 +165,7 @@ bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only
    PointCloud::Ptr ma_coords_masked(new PointCloud);
    ma_coords_masked->reserve(count);
 
-   for (int i = 0; i < N; i++) {
+   for (Index i = 0; i < N; i++) {
       if (bisec_mask[i])
          ma_coords_masked->push_back((*madata.ma_coords)[i]);
    }
@@ -162,7 +177,7 @@ bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only
 
    {
       // rebuild kd-tree
-      pcl::search::KdTree<Point>::Ptr kd_tree(new pcl::search::KdTree<Point>());
+      flat_kdtree::Ptr kd_tree(new flat_kdtree());
       kd_tree->setInputCloud(ma_coords_masked);
 #ifdef VERBOSEPRINT
       elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
@@ -170,15 +185,24 @@ bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only
       start_time = Clock::now();
 #endif
 
-      // Results from our search
-      std::vector<int> k_indices(1);
-      std::vector<Scalar> k_distances(1);
-
-#pragma omp parallel for private(k_indices, k_distances)
-      for (int i = 0; i < madata.coords->size(); i++) {
-         kd_tree->nearestKSearch((*madata.coords)[i], 1, k_indices, k_distances); // find closest point to c
+      // The closest cleaned MA point of each input point, in batches of consecutive points so that
+      // the tree can interleave their traversals
+      const size_t lfs_batch = 64;
+      size_t M = madata.coords->size();
+      Index batches = Index((M + lfs_batch - 1) / lfs_batch);
+#pragma omp parallel for
+      for (Index k = 0; k < batches; k++) {
+         size_t begin = k * lfs_batch, end = std::min(begin + lfs_batch, M);
+         flat_kdtree::nn_query queries[lfs_batch];
+         for (size_t i = begin; i < end; i++) {
+            queries[i - begin].point = (*madata.coords)[i].getVector3fMap();
+            queries[i - begin].max_sqr_dist = std::numeric_limits<Scalar>::max();
+         }
+         kd_tree->nearest_batch(queries, end - begin);
 
-         madata.lfs[i] = std::sqrt(k_distances[0]);
+         // points with non-finite coordinates find no MA point
+         for (size_t i = begin; i < end; i++)
+            madata.lfs[i] = queries[i - begin].index == -1 ? std::numeric_limits<Scalar>::quiet_NaN() : std::sqrt(queries[i - begin].sqr_dist);
       }
 #ifdef VERBOSEPRINT
       elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
@@ -261,7 +285,7 @@ void simplify(ma_data &madata,
 
    size_t* idx = new size_t[3];
    size_t index;
-   for (int i = 0; i < madata.coords->size(); i++) {
+   for (Index i = 0; i < madata.coords->size(); i++) {
       idx[0] = size_t(((*madata.coords)[i].x - origin.x) / cellsize);
       idx[1] = size_t(((*madata.coords)[i].y - origin.y) / cellsize);
       if (true_z_dim)
@@ -381,10 +405,6 @@ void simplify(normals_parameters &normals_params,
 
    ///////////////////////////
    // Step 2: compute ma
-   PointCloud::Ptr ma_coords(new PointCloud);
-   ma_coords->resize(2*madata.coords->size());
-   madata.ma_coords = ma_coords; // add to the reference count
-   madata.ma_qidx.resize(2 * madata.coords->size());
    compute_masb_points(ma_params, madata, callback);
 
    ///////////////////////////
@@ -42,6 +42,11 @@ struct simplify_parameters {
 };
 
 
+// Fills madata.lfs (sized to the number of points) with the distance of every point to the closest MAT point
+// that survives the bisector based cleaning. Returns false if there are no such MAT points, madata.lfs is
+// left as is then. With only_inner and both sides in madata, the exterior ma_coords are dropped.
+bool compute_lfs(ma_data &madata, double bisec_threshold, int bisec_k, bool only_inner = true);
+
 // This version of simplify takes in an already calculated ma, etc.
 void simplify_lfs(simplify_parameters &input_parameters, ma_data& madata);
 
@@ -0,0 +1,297 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "tile_farm.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+#include "npy_view.h"
+
+// The arrays that are merged when the workers wrote them
+const char *const farm_arrays[] = {
+   "normals", "ma_coords_in", "ma_coords_out", "ma_qidx_in", "ma_qidx_out", "ma_radius_in", "ma_radius_out", "lfs"
+};
+// Other files in the tile directories that are removed with them
+const char *const farm_files[] = { "coords.npy", "index.npy", "log.txt", "masb_tiles" };
+
+inline void farm_error(const std::string &message, const std::string &path) {
+   std::cerr << message << " " << path << std::endl;
+   exit(1);
+}
+
+inline bool file_exists(const std::string &path) {
+   return bool(std::ifstream(path.c_str()));
+}
+
+void make_directory(const std::string &path) {
+#ifdef _WIN32
+   int result = _mkdir(path.c_str());
+#else
+   int result = mkdir(path.c_str(), 0777);
+#endif
+   if (result != 0 && errno != EEXIST)
+      farm_error("Could not create directory", path);
+}
+
+void remove_directory(const std::string &path) {
+#ifdef _WIN32
+   _rmdir(path.c_str());
+#else
+   rmdir(path.c_str());
+#endif
+}
+
+// Lets every worker use the given number of OpenMP threads
+void set_worker_threads(int threads) {
+   std::string value = std::to_string(threads);
+#ifdef _WIN32
+   _putenv_s("OMP_NUM_THREADS", value.c_str());
+#else
+   setenv("OMP_NUM_THREADS", value.c_str(), 1);
+#endif
+}
+
+struct farm_tile {
+   tile_job job;   // without its points once they are written
+   size_t points;
+   std::string dir;
+   std::string command;
+   int attempts;
+};
+
+// Point index stored as T in a tile array
+template <class T>
+inline Index tile_index(const void *data, size_t i) {
+   return Index(static_cast<const T *>(data)[i]);
+}
+
+// Merges the rows of the points of each tile itself of array name into output_dir
+void merge_array(const std::string &output_dir, const std::string &name, const std::vector<farm_tile> &tiles, const float *xyz, size_t N) {
+   std::cout << "Merging " << name << " arrays..." << std::endl;
+
+   char type;
+   size_t word_size, columns;
+   {
+      npy_view first(tiles[0].dir + "/" + name + ".npy");
+      type = first.type();
+      word_size = first.word_size();
+      columns = first.shape().size() > 1 ? first.shape()[1] : 0;
+   }
+   bool qidx = name.compare(0, 7, "ma_qidx") == 0, lfs = name == "lfs";
+   if (qidx && (type != 'i' || (word_size != 4 && word_size != 8)))
+      farm_error("Unexpected type of", tiles[0].dir + "/" + name + ".npy");
+   if (lfs && (type != 'f' || word_size != 4))
+      farm_error("Unexpected type of", tiles[0].dir + "/" + name + ".npy");
+
+   npy_writer out(output_dir + "/" + name + ".npy", qidx ? 'i' : type, qidx ? sizeof(Index) : word_size, N, columns);
+   size_t row_size = word_size * (columns ? columns : 1);
+   char *out_rows = static_cast<char *>(out.data());
+
+   for (const farm_tile &tile : tiles) {
+      npy_view index(tile.dir + "/index.npy");
+      index.require('i', sizeof(Index), 0);
+      npy_view in(tile.dir + "/" + name + ".npy");
+      in.require(type, word_size, columns);
+      if (in.shape()[0] != tile.points || index.shape()[0] != tile.points)
+         farm_error("Mismatched number of points in", tile.dir + "/" + name + ".npy");
+
+      const Index *global = index.as<Index>();
+      const char *in_rows = static_cast<const char *>(in.data());
+      // a worker may write anything, a q index must be one of the points of its tile
+      bool valid = true;
+#pragma omp parallel for reduction(&&:valid)
+      for (Index r = 0; r < tile.job.core; r++) {
+         size_t i = size_t(global[r]);
+         if (qidx) {
+            Index q = word_size == 8 ? tile_index<int64_t>(in.data(), r) : tile_index<int32_t>(in.data(), r);
+            bool in_tile = q >= 0 && size_t(q) < tile.points;
+            valid = valid && (in_tile || q == -1);
+            out.as<Index>()[i] = in_tile ? global[q] : -1;
+         }
+         else if (lfs) // approximate, see cap_lfs()
+            out.as<float>()[i] = float(cap_lfs(tile.job, xyz + 3 * i, in.as<float>()[r]));
+         else
+            std::memcpy(out_rows + i * row_size, in_rows + r * row_size, row_size);
+      }
+      if (!valid)
+         farm_error("Point index out of range in", tile.dir + "/" + name + ".npy");
+   }
+}
+
+bool run_farm(std::string input_dir, std::string output_dir, tile_parameters &tile_params, farm_parameters &farm_params) {
+   npy_view coords(input_dir + "/coords.npy");
+   coords.require('f', 4, 3);
+   size_t N = coords.shape()[0];
+   if (N == 0)
+      farm_error("No points in", input_dir + "/coords.npy");
+   if (N - 1 > size_t(std::numeric_limits<Index>::max())) {
+      std::cerr << "Too many points for the point indices of this build, rebuild with MASB_INDEX64" << std::endl;
+      exit(1);
+   }
+   const float *xyz = coords.as<float>();
+
+   // Write every tile with its halo to a directory of its own
+   std::string tiles_dir = output_dir + "/tiles";
+   make_directory(tiles_dir);
+   std::vector<farm_tile> tiles;
+   for_each_tile(xyz, N, tile_params, tiles_dir + "/tile_order.tmp", [&](tile_job &job) {
+      farm_tile tile;
+      tile.dir = tiles_dir + "/tile_" + std::to_string(job.id);
+      tile.points = job.points.size();
+      tile.attempts = 0;
+      make_directory(tile.dir);
+      {
+         npy_writer tile_coords(tile.dir + "/coords.npy", 'f', 4, tile.points, 3);
+         npy_writer tile_index(tile.dir + "/index.npy", 'i', sizeof(Index), tile.points, 0);
+#pragma omp parallel for
+         for (Index k = 0; k < tile.points; k++) {
+            std::memcpy(tile_coords.as<float>() + 3 * size_t(k), xyz + 3 * size_t(job.points[k]), 3 * sizeof(float));
+            tile_index.as<Index>()[k] = job.points[k];
+         }
+      }
+      job.points = std::vector<Index>();
+      tile.job = job;
+
+      std::ostringstream command;
+      command << "\"" << farm_params.worker << "\" \"" << tile.dir << "\"";
+      // one tile that covers the whole directory and is never split
+      if (farm_params.default_worker)
+         command << " -t " << std::setprecision(17) << 2 * (tile_params.tile_size + 2 * tile_params.halo) << " -m " << tile.points;
+      if (!farm_params.worker_args.empty())
+         command << " " << farm_params.worker_args;
+      command << " > \"" << tile.dir << "/log.txt\" 2>&1";
+      tile.command = command.str();
+#ifdef _WIN32
+      // cmd /c strips the first and the last quote of the command, which would break the quoted paths
+      tile.command = "\"" + tile.command + "\"";
+#endif
+      tiles.push_back(tile);
+   });
+
+   // Hand out the tiles to the workers from a queue
+   std::deque<size_t> queue;
+   for (size_t k = 0; k < tiles.size(); k++)
+      queue.push_back(k);
+   std::vector<size_t> failed;
+   size_t finished = 0;
+#ifndef WITH_OPENMP
+   farm_params.processes = 1;
+#endif
+   // Unless told otherwise, workers that run side by side divide the cores between them
+   int threads = farm_params.threads;
+#ifdef WITH_OPENMP
+   if (threads <= 0 && farm_params.processes > 1)
+      threads = std::max(1, omp_get_num_procs() / farm_params.processes);
+#endif
+   if (threads > 0)
+      set_worker_threads(threads);
+   std::cout << "Running " << tiles.size() << " tiles on " << farm_params.processes << " workers: " << farm_params.worker << std::endl;
+
+#pragma omp parallel num_threads(farm_params.processes)
+   {
+      for (;;) {
+         size_t k = 0;
+         bool next = false;
+#pragma omp critical(farm_queue)
+         if (!queue.empty()) {
+            k = queue.front();
+            queue.pop_front();
+            next = true;
+         }
+         if (!next)
+            break;
+
+         int status = std::system(tiles[k].command.c_str());
+#ifndef _WIN32
+         if (status != -1 && WIFEXITED(status))
+            status = WEXITSTATUS(status);
+#endif
+
+#pragma omp critical(farm_queue)
+         {
+            farm_tile &tile = tiles[k];
+            tile.attempts++;
+            if (status == 0)
+               std::cout << "Tile " << tile.job.id << " done [" << ++finished << "/" << tiles.size() << "]" << std::endl;
+            else if (tile.attempts <= farm_params.retries) {
+               std::cout << "Tile " << tile.job.id << " failed (" << status << "), retrying, see " << tile.dir << "/log.txt" << std::endl;
+               queue.push_back(k);
+            }
+            else {
+               std::cout << "Tile " << tile.job.id << " failed (" << status << ") " << tile.attempts << " times, see " << tile.dir << "/log.txt" << std::endl;
+               failed.push_back(k);
+            }
+         }
+      }
+   }
+
+   if (!failed.empty()) {
+      std::cerr << failed.size() << " of " << tiles.size() << " tiles failed, nothing is merged. The tiles are kept in " << tiles_dir << std::endl;
+      return false;
+   }
+
+   // Every worker writes the same arrays
+   std::vector<std::string> arrays;
+   for (const char *name : farm_arrays)
+      if (file_exists(tiles[0].dir + "/" + name + ".npy"))
+         arrays.push_back(name);
+   if (arrays.empty())
+      farm_error("The workers wrote no arrays to merge in", tiles[0].dir);
+   for (const std::string &name : arrays)
+      merge_array(output_dir, name, tiles, xyz, N);
+
+   if (!farm_params.keep) {
+      for (const farm_tile &tile : tiles) {
+         for (const std::string &name : arrays)
+            std::remove((tile.dir + "/" + name + ".npy").c_str());
+         for (const char *name : farm_files)
+            std::remove((tile.dir + "/" + name).c_str());
+         remove_directory(tile.dir);
+      }
+      remove_directory(tiles_dir);
+   }
+   return true;
+}
@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_TILE_FARM_
+#define MASBCPP_TILE_FARM_
+
+#include <string>
+
+#include "tiled_processing.h"
+
+struct farm_parameters {
+   // Program that processes a tile, it is run with the tile directory as its first argument, followed by worker_args.
+   // When worker is masb_tiles (default_worker), the arguments that keep a tile in one piece are added as well.
+   std::string worker;
+   bool default_worker;
+   std::string worker_args;
+   int processes;   // workers that run at the same time
+   int threads;     // OpenMP threads of each worker, 0 divides the cores over the processes
+   int retries;     // times a failed tile is run again
+   bool keep;       // keep the tile directories
+};
+
+// Splits the points of coords.npy in input_dir into tiles (see for_each_tile()) and writes each tile with its halo
+// to a directory in output_dir/tiles, as coords.npy and index.npy with the index in the input of each point.
+// The workers are started on the tiles from a queue, farm_params.processes at a time (one at a time in builds
+// without OpenMP), each as a separate process. A tile whose worker fails is queued again up to farm_params.retries times. Once all tiles are done,
+// the arrays the workers wrote (normals, ma_coords, ma_qidx, ma_radius and lfs) are merged into output_dir,
+// with the rows of the points of each tile itself, in input order. The ma_qidx values are mapped to input
+// indices and the lfs is capped as in compute_tiled(), so it is approximate as well.
+//
+// Returns false, without merging and keeping the tile directories, if a tile still fails after its retries.
+bool run_farm(std::string input_dir, std::string output_dir, tile_parameters &tile_params, farm_parameters &farm_params);
+
+#endif
@@ -0,0 +1,382 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "tiled_processing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#ifdef VERBOSEPRINT
+#include <chrono>
+typedef std::chrono::high_resolution_clock Clock;
+#endif
+
+#include "mapped_file.h"
+#include "morton.h"
+#include "npy_view.h"
+
+// Tiles are split in four at most this many times when they hold more than max_points
+const int max_split_depth = 16;
+
+// Square tiles in x and y over the bounding box of the points, with the indices of the points sorted by tile
+struct tile_grid {
+   const float *xyz;
+   double min[2], max[2]; // bounding box of the points
+   double size;
+   size_t nx, ny;
+   // the points of tile t are order[offsets[t]] up to order[offsets[t + 1]], in increasing order
+   std::vector<size_t> offsets;
+   const Index *order;
+
+   // Column (k = 0) or row (k = 1) of coordinate v, clamped to the grid
+   size_t cell(double v, int k) const {
+      double c = std::floor((v - min[k]) / size);
+      size_t n = k == 0 ? nx : ny;
+      return c < 0 ? 0 : std::min(n - 1, size_t(c));
+   }
+   size_t tile(const float *p) const { return cell(p[0], 0) + nx * cell(p[1], 1); }
+};
+
+// Collects the points within halo of the box lo-hi that are not in core, from the tiles that overlap
+// that range. core holds points of tile only.
+void gather_halo(const tile_grid &grid, size_t tile, const std::vector<Index> &core, const double lo[2], const double hi[2], double halo, std::vector<Index> &points) {
+   size_t x0 = grid.cell(lo[0] - halo, 0), x1 = grid.cell(hi[0] + halo, 0);
+   size_t y0 = grid.cell(lo[1] - halo, 1), y1 = grid.cell(hi[1] + halo, 1);
+   for (size_t cy = y0; cy <= y1; cy++) {
+      for (size_t cx = x0; cx <= x1; cx++) {
+         size_t t = cx + grid.nx * cy;
+         bool own = t == tile;
+         if (own && core.size() == grid.offsets[t + 1] - grid.offsets[t])
+            continue;
+         for (size_t j = grid.offsets[t]; j < grid.offsets[t + 1]; j++) {
+            Index i = grid.order[j];
+            const float *p = grid.xyz + 3 * size_t(i);
+            if (p[0] < lo[0] - halo || p[0] > hi[0] + halo || p[1] < lo[1] - halo || p[1] > hi[1] + halo)
+               continue;
+            if (own && std::binary_search(core.begin(), core.end(), i))
+               continue;
+            points.push_back(i);
+         }
+      }
+   }
+}
+
+struct tiling {
+   const tile_grid &grid;
+   const tile_parameters &tile_params;
+   std::function<void(tile_job &job)> &process;
+   size_t jobs;
+};
+
+// Hands the core points, which lie in the box lo-hi of tile, to process with their halo, or its four quadrants
+// in turn if the core points with their halo are more than max_points. core is released on return.
+void split_tile(tiling &tiles, size_t tile, std::vector<Index> &core, const double lo[2], const double hi[2], int depth) {
+   const tile_grid &grid = tiles.grid;
+   double halo_width = tiles.tile_params.halo;
+   std::vector<Index> halo;
+   gather_halo(grid, tile, core, lo, hi, halo_width, halo);
+
+   // Splitting tiles that are narrower than the halo hardly reduces the number of points
+   if (core.size() + halo.size() > tiles.tile_params.max_points && core.size() > 1 && depth < max_split_depth
+       && std::max(hi[0] - lo[0], hi[1] - lo[1]) > halo_width) {
+      halo = std::vector<Index>();
+      double mid[2] = { (lo[0] + hi[0]) / 2, (lo[1] + hi[1]) / 2 };
+      std::vector<Index> quadrants[4];
+      for (Index i : core) {
+         const float *p = grid.xyz + 3 * size_t(i);
+         quadrants[(p[0] >= mid[0]) + 2 * (p[1] >= mid[1])].push_back(i);
+      }
+      core = std::vector<Index>();
+
+      for (int q = 0; q < 4; q++) {
+         if (quadrants[q].empty())
+            continue;
+         double qlo[2] = { q & 1 ? mid[0] : lo[0], q & 2 ? mid[1] : lo[1] };
+         double qhi[2] = { q & 1 ? hi[0] : mid[0], q & 2 ? hi[1] : mid[1] };
+         split_tile(tiles, tile, quadrants[q], qlo, qhi, depth + 1);
+      }
+      return;
+   }
+
+   tile_job job;
+   job.id = tiles.jobs++;
+   job.column = tile % grid.nx;
+   job.row = tile / grid.nx;
+   for (int k = 0; k < 2; k++) {
+      job.lo[k] = lo[k];
+      job.hi[k] = hi[k];
+      job.halo_lo[k] = lo[k] - halo_width > grid.min[k] ? lo[k] - halo_width : -std::numeric_limits<double>::max();
+      job.halo_hi[k] = hi[k] + halo_width < grid.max[k] ? hi[k] + halo_width : std::numeric_limits<double>::max();
+   }
+   job.core = core.size();
+   job.points.swap(core);
+   job.points.insert(job.points.end(), halo.begin(), halo.end());
+   halo = std::vector<Index>();
+
+   std::cout << "Tile " << job.id << " (" << job.column << "," << job.row;
+   if (depth > 0)
+      std::cout << ", part " << lo[0] << "," << lo[1] << " - " << hi[0] << "," << hi[1];
+   std::cout << "): " << job.core << " points, " << job.points.size() - job.core << " in the halo" << std::endl;
+   if (job.points.size() > tiles.tile_params.max_points)
+      std::cout << "Warning: tile exceeds " << tiles.tile_params.max_points << " points, it can't be split any further" << std::endl;
+
+   tiles.process(job);
+}
+
+void for_each_tile(const float *xyz, size_t N, tile_parameters &tile_params, std::string scratch_path,
+                   std::function<void(tile_job &job)> process) {
+#ifdef VERBOSEPRINT
+   auto start_time = Clock::now();
+#endif
+   if (N == 0)
+      return;
+
+   tile_grid grid;
+   grid.xyz = xyz;
+
+   // Bounding box in x and y, in one pass over the points
+   grid.min[0] = grid.min[1] = std::numeric_limits<double>::max();
+   grid.max[0] = grid.max[1] = -std::numeric_limits<double>::max();
+   for (size_t i = 0; i < N; i++) {
+      for (int k = 0; k < 2; k++) {
+         double v = xyz[3 * i + k];
+         grid.min[k] = std::min(grid.min[k], v);
+         grid.max[k] = std::max(grid.max[k], v);
+      }
+   }
+   double width = grid.max[0] - grid.min[0], depth = grid.max[1] - grid.min[1];
+
+   grid.size = tile_params.tile_size;
+   if (!(grid.size > 0)) {
+      // Tiles that hold max_points with their halo at the average density, but no narrower than the halo
+      double density = N / std::max(width * depth, 1e-12);
+      grid.size = std::max(std::sqrt(tile_params.max_points / density) - 2 * tile_params.halo, tile_params.halo);
+      if (!(grid.size > 0))
+         grid.size = std::max(std::max(width, depth), 1.0);
+   }
+   tile_params.tile_size = grid.size;
+   grid.nx = size_t(width / grid.size) + 1;
+   grid.ny = size_t(depth / grid.size) + 1;
+   std::cout << "Tiling " << N << " points into " << grid.nx << " x " << grid.ny << " tiles of " << grid.size << " with a halo of " << tile_params.halo << std::endl;
+
+   // Counting sort of the point indices by tile into a mapped scratch file
+   grid.offsets.assign(grid.nx * grid.ny + 1, 0);
+   for (size_t i = 0; i < N; i++)
+      grid.offsets[grid.tile(xyz + 3 * i) + 1]++;
+   for (size_t t = 0; t < grid.nx * grid.ny; t++)
+      grid.offsets[t + 1] += grid.offsets[t];
+
+   {
+      file_writer order_file(scratch_path, N * sizeof(Index));
+      Index *order = reinterpret_cast<Index *>(order_file.data());
+      {
+         std::vector<size_t> next(grid.offsets.begin(), grid.offsets.end() - 1);
+         for (size_t i = 0; i < N; i++)
+            order[next[grid.tile(xyz + 3 * i)]++] = Index(i);
+      }
+      grid.order = order;
+#ifdef VERBOSEPRINT
+      auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
+      std::cout << "Binned the points in " << elapsed_time.count() << " ms" << std::endl;
+#endif
+
+      tiling tiles = { grid, tile_params, process, 0 };
+      for (size_t t = 0; t < grid.nx * grid.ny; t++) {
+         if (grid.offsets[t] == grid.offsets[t + 1])
+            continue;
+         std::vector<Index> core(order + grid.offsets[t], order + grid.offsets[t + 1]);
+         double lo[2] = { grid.min[0] + (t % grid.nx) * grid.size, grid.min[1] + (t / grid.nx) * grid.size };
+         double hi[2] = { lo[0] + grid.size, lo[1] + grid.size };
+         split_tile(tiles, t, core, lo, hi, 0);
+      }
+   }
+   std::remove(scratch_path.c_str());
+}
+
+// The mapped output files, each holds the arrays of all points
+struct tiled_output {
+   std::unique_ptr<npy_writer> normals, lfs;
+   std::unique_ptr<npy_writer> ma_coords[2], ma_qidx[2], ma_radius[2];
+};
+
+struct tiled_context {
+   const float *xyz;
+   tiled_output &out;
+   tile_parameters &tile_params;
+   normals_parameters &normals_params;
+   ma_parameters &ma_params;
+   simplify_parameters &lfs_params;
+   io_parameters &output;
+};
+
+// Processes the points of job with their halo and writes the results of the points of the job itself
+void run_tile(tiled_context &ctx, const tile_job &job) {
+   const size_t C = job.core, M = job.points.size();
+   io_parameters &output = ctx.output;
+
+   // The points are gathered as in job.points, madata.order maps them back after morton_sort()
+   ma_data madata = {};
+   madata.coords.reset(new PointCloud);
+   madata.coords->resize(M);
+#pragma omp parallel for
+   for (Index g = 0; g < M; g++) {
+      const float *p = ctx.xyz + 3 * size_t(job.points[g]);
+      Point &pt = (*madata.coords)[g];
+      pt.x = p[0];
+      pt.y = p[1];
+      pt.z = p[2];
+   }
+   if (ctx.tile_params.morton)
+      morton_sort(madata);
+   auto gathered = [&](size_t j) -> size_t { return madata.order.empty() ? j : size_t(madata.order[j]); };
+   auto global = [&](size_t j) -> Index { return job.points[gathered(j)]; };
+
+   madata.normals.reset(new NormalCloud);
+   madata.normals->resize(M);
+   compute_normals(ctx.normals_params, madata);
+   if (output.normal_bits)
+      pack_normals(madata, output.normal_bits);
+
+   bool ma = output.ma_coords || output.ma_qidx || output.ma_radius || output.lfs;
+   if (ma)
+      compute_masb_points(ctx.ma_params, madata);
+
+   tiled_output &out = ctx.out;
+#pragma omp parallel for
+   for (Index j = 0; j < M; j++) {
+      if (gathered(j) >= C)
+         continue;
+      size_t i = size_t(global(j));
+
+      if (out.normals) {
+         if (madata.packed_normals.bits == 32)
+            out.normals->as<uint32_t>()[i] = madata.packed_normals.oct32[j];
+         else if (madata.packed_normals.bits == 16)
+            out.normals->as<uint16_t>()[i] = madata.packed_normals.oct16[j];
+         else {
+            const Normal &nm = (*madata.normals)[j];
+            float *v = out.normals->as<float>() + 3 * i;
+            v[0] = nm.normal_x;
+            v[1] = nm.normal_y;
+            v[2] = nm.normal_z;
+         }
+      }
+      if (!ma)
+         continue;
+
+      for (int side = MA_INNER; side <= MA_OUTER; side++) {
+         if (!(madata.sides & side))
+            continue;
+         size_t k = (side == MA_OUTER && madata.sides == MA_BOTH ? M : 0) + j;
+         if (out.ma_coords[side - 1]) {
+            const Point &c = (*madata.ma_coords)[k];
+            float *v = out.ma_coords[side - 1]->as<float>() + 3 * i;
+            v[0] = c.x;
+            v[1] = c.y;
+            v[2] = c.z;
+         }
+         if (out.ma_qidx[side - 1]) {
+            Index q = madata.ma_qidx[k];
+            out.ma_qidx[side - 1]->as<Index>()[i] = q == -1 ? -1 : global(q);
+         }
+         if (out.ma_radius[side - 1])
+            out.ma_radius[side - 1]->as<float>()[i] = madata.ma_radius[k];
+      }
+   }
+
+   // compute_lfs() may drop the exterior balls, so it runs once those are written
+   if (out.lfs) {
+      madata.lfs.resize(M);
+      bool have_lfs = compute_lfs(madata, ctx.lfs_params.bisec_threshold, ctx.lfs_params.bisec_k, ctx.lfs_params.only_inner);
+
+      // Without MA points in the tile the closest one lies beyond the halo, so the lfs is the distance to its
+      // edge. As without tiles, the lfs stays 0 when there are no MA points at all, ie. when the halo is open
+      // on all sides.
+      const double open = std::numeric_limits<double>::max();
+#pragma omp parallel for
+      for (Index j = 0; j < M; j++) {
+         if (gathered(j) >= C)
+            continue;
+         double lfs = cap_lfs(job, ctx.xyz + 3 * size_t(global(j)), have_lfs ? double(madata.lfs[j]) : open);
+         if (lfs < open)
+            out.lfs->as<float>()[global(j)] = float(lfs);
+      }
+   }
+}
+
+void compute_tiled(std::string input_dir, std::string output_dir, tile_parameters &tile_params,
+                   normals_parameters &normals_params, ma_parameters &ma_params,
+                   simplify_parameters &lfs_params, io_parameters &output) {
+#ifdef VERBOSEPRINT
+   auto start_time = Clock::now();
+#endif
+
+   npy_view coords(input_dir + "/coords.npy");
+   coords.require('f', 4, 3);
+   size_t N = coords.shape()[0];
+   if (N == 0) {
+      std::cerr << "No points in " << input_dir << "/coords.npy" << std::endl;
+      exit(1);
+   }
+   if (N - 1 > size_t(std::numeric_limits<Index>::max())) {
+      std::cerr << "Too many points for the point indices of this build, rebuild with MASB_INDEX64" << std::endl;
+      exit(1);
+   }
+
+   tiled_output out;
+   if (output.normals) {
+      if (output.normal_bits)
+         out.normals.reset(new npy_writer(output_dir + "/normals.npy", 'u', output.normal_bits / 8, N, 0));
+      else
+         out.normals.reset(new npy_writer(output_dir + "/normals.npy", 'f', 4, N, 3));
+   }
+   ma_sides sides = ma_params.sides ? ma_params.sides : MA_INNER;
+   for (int side = MA_INNER; side <= MA_OUTER; side++) {
+      if (!(sides & side))
+         continue;
+      std::string suffix = side == MA_INNER ? "_in" : "_out";
+      if (output.ma_coords)
+         out.ma_coords[side - 1].reset(new npy_writer(output_dir + "/ma_coords" + suffix + ".npy", 'f', 4, N, 3));
+      if (output.ma_qidx)
+         out.ma_qidx[side - 1].reset(new npy_writer(output_dir + "/ma_qidx" + suffix + ".npy", 'i', sizeof(Index), N, 0));
+      if (output.ma_radius)
+         out.ma_radius[side - 1].reset(new npy_writer(output_dir + "/ma_radius" + suffix + ".npy", 'f', 4, N, 0));
+   }
+   if (output.lfs)
+      out.lfs.reset(new npy_writer(output_dir + "/lfs.npy", 'f', 4, N, 0));
+
+   tiled_context ctx = { coords.as<float>(), out, tile_params, normals_params, ma_params, lfs_params, output };
+   for_each_tile(coords.as<float>(), N, tile_params, output_dir + "/tile_order.tmp", [&](tile_job &job) {
+      run_tile(ctx, job);
+   });
+
+#ifdef VERBOSEPRINT
+   auto elapsed_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start_time);
+   std::cout << "Processed all tiles in " << elapsed_time.count() << " ms" << std::endl;
+#endif
+}
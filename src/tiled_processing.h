@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_TILED_PROCESSING_
+#define MASBCPP_TILED_PROCESSING_
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "io.h"
+#include "compute_normals_processing.h"
+#include "compute_ma_processing.h"
+#include "simplify_processing.h"
+
+struct tile_parameters {
+   double tile_size;   // edge length of the square tiles in x and y, 0 derives it from max_points
+   double halo;        // width of the band around a tile from which the neighbouring points are included
+   size_t max_points;  // most points, halo included, to process at once. Tiles with more are split in four.
+   bool morton;        // process the points of each tile in Morton order
+};
+
+// The points of one tile, or of a part of it when it was split
+struct tile_job {
+   size_t id;                 // number of the job, in the order they are made
+   size_t column, row;        // of the tile in the grid
+   double lo[2], hi[2];       // box of the points of the job
+   // Box of the points within the halo, with sides at the largest double where there are no points beyond
+   double halo_lo[2], halo_hi[2];
+   // Indices of the points of the job, followed by those of the points in its halo
+   std::vector<Index> points;
+   size_t core;               // number of points of the job at the front of points
+};
+
+// Bins the points (N x 3 floats, typically a mapped coords.npy) into a grid of square tiles in x and y and
+// calls process for each tile with the points within halo of it, or for each of its quadrants (recursively)
+// if that is more than max_points. scratch_path receives the point indices sorted by tile while it runs.
+// tile_params.tile_size receives the tile size when it is to be derived.
+void for_each_tile(const float *xyz, size_t N, tile_parameters &tile_params, std::string scratch_path,
+                   std::function<void(tile_job &job)> process);
+
+// The lfs of a point of job is capped at the distance to the edge of the halo, a stand-in for the MA points
+// that the tile does not have. This is an approximation and not a bound: the center of a ball of a point
+// beyond the halo can lie up to the initial radius inside it, balls of points near the edge of the halo
+// differ from those of the whole cloud, and the bisector cleaning sees fewer neighbours there.
+inline double cap_lfs(const tile_job &job, const float *p, double lfs) {
+   for (int k = 0; k < 2; k++)
+      lfs = std::min(lfs, std::min(p[k] - job.halo_lo[k], job.halo_hi[k] - p[k]));
+   return lfs;
+}
+
+// Runs compute_normals(), compute_masb_points() and compute_lfs() on the points of coords.npy in input_dir one
+// tile at a time (see for_each_tile()), so that only the arrays of a single tile are in memory. Only the results
+// of the points of the tile itself are kept. Those go straight into the output files in output_dir, which are
+// mapped and hold all points in input order. output selects the arrays to write (normals, ma_coords, ma_qidx,
+// ma_radius and lfs), with normal_bits the normals are written in octahedral encoding.
+//
+// A ball found in a tile is the one found in the whole cloud when no point outside the halo is within the
+// initial ball, ie. when the halo is at least twice the initial radius. The lfs is only an approximation of
+// that of the whole cloud, see cap_lfs().
+void compute_tiled(std::string input_dir, std::string output_dir, tile_parameters &tile_params,
+                   normals_parameters &normals_params, ma_parameters &ma_params,
+                   simplify_parameters &lfs_params, io_parameters &output);
+
+#endif
@@ -23,6 +23,9 @@ SOFTWARE.
 #ifndef MASBCPP_TYPES_
 #define MASBCPP_TYPES_
 
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include <vector>
 
 #include <Eigen/Core>
@@ -37,7 +40,23 @@ typedef Eigen::Matrix<Scalar, 3, Eigen::Dynamic> Array3X;
 typedef Eigen::Matrix<int, Eigen::Dynamic, 1> ArrayXi; // Type for 1D int arrays
 typedef Eigen::Matrix<bool, Eigen::Dynamic, 1> ArrayXb; // Type for 1D bool arrays
 
-typedef std::vector<int> intList; // Type for ints
+// std::isfinite may be optimised away under -ffast-math, test the exponent bits instead
+inline bool is_finite(Scalar v) {
+   uint32_t bits;
+   std::memcpy(&bits, &v, sizeof(bits));
+   return (bits & 0x7f800000u) != 0x7f800000u;
+}
+
+// Type for point indices. 32 bit indices keep the index arrays and the kd-tree compact,
+// build with MASB_INDEX64 for clouds of more than 2^31 points (or 2^30 with both ma sides).
+#ifdef MASB_INDEX64
+typedef int64_t Index;
+#else
+typedef int32_t Index;
+#endif
+typedef std::make_unsigned<Index>::type UIndex;
+
+typedef std::vector<Index> intList; // Type for point indices
 
 typedef pcl::PointXYZ Point;
 typedef pcl::Normal Normal;
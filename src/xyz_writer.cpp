@@ -0,0 +1,267 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "xyz_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef WITH_OPENMP
+#include <omp.h>
+#endif
+
+// Powers of ten that are exact in a double
+const double exact_pow10[] = {
+   1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+const uint64_t int_pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+// Points per block of text that one thread formats
+const size_t xyz_block = 1 << 16;
+
+inline double scale_pow10(double v, int k) {
+   return k >= 0 ? v * exact_pow10[k] : v / exact_pow10[-k];
+}
+
+// Whether the decimal that d holds, correctly rounded unless it is exact, reads back as f. Rounding d once
+// more to a float can go wrong if d lies exactly halfway between two floats while the decimal does not.
+inline bool reads_as(double d, bool exact, float f) {
+   if (float(d) != f)
+      return false;
+   if (exact)
+      return true;
+   uint64_t bits;
+   std::memcpy(&bits, &d, sizeof(bits));
+   return (bits & 0x1fffffff) != 0x10000000;
+}
+
+char *format_float(char *out, float v) {
+   // the bits tell non-finite values apart, comparisons can't be trusted with -ffast-math
+   uint32_t bits;
+   std::memcpy(&bits, &v, sizeof(bits));
+   if (bits >> 31) {
+      *out++ = '-';
+      bits &= 0x7fffffff;
+      std::memcpy(&v, &bits, sizeof(bits));
+   }
+   if ((bits >> 23) == 0xff) {
+      std::memcpy(out, (bits & 0x7fffff) ? "nan" : "inf", 3);
+      return out + 3;
+   }
+   // with denormals flushed to zero only the bits tell these apart from zero
+   double d = v;
+   if (bits == 0 || !(d > 0)) {
+      *out++ = '0';
+      return out;
+   }
+
+   // Round to 9 significant digits, which always identify a float, then find the fewest leading digits
+   // that still read back as v. Outside the range where the powers of ten are exact we leave it to printf.
+   int e10 = int(std::floor(std::log10(d)));
+   uint64_t m9 = 0;
+   bool fast = e10 >= -14 && e10 <= 22;
+   if (fast) {
+      m9 = uint64_t(std::llround(scale_pow10(d, 8 - e10)));
+      if (m9 >= int_pow10[9] || m9 < int_pow10[8]) {
+         e10 += m9 >= int_pow10[9] ? 1 : -1;
+         fast = e10 >= -14 && e10 <= 22;
+         if (fast)
+            m9 = uint64_t(std::llround(scale_pow10(d, 8 - e10)));
+      }
+   }
+   uint64_t m = 0;
+   int k = 0;
+   bool found = false;
+   for (int p = 1; fast && p <= 9 && !found; p++) {
+      // the nearest p digits first, then the other neighbour, since m9 itself is already rounded
+      uint64_t q = int_pow10[9 - p], lo = m9 / q;
+      m = (m9 + q / 2) / q;
+      k = e10 - p + 1;
+      found = reads_as(scale_pow10(double(m), k), k >= 0 && e10 < 15, v);
+      if (!found && p < 9) {
+         m = m == lo ? lo + 1 : lo;
+         found = m > 0 && reads_as(scale_pow10(double(m), k), k >= 0 && e10 < 15, v);
+      }
+   }
+   if (!found)
+      return out + std::sprintf(out, "%.9g", double(v));
+
+   while (m % 10 == 0) {
+      m /= 10;
+      k++;
+   }
+   char digits[10];
+   int n = 0;
+   for (uint64_t r = m; r; r /= 10)
+      n++;
+   for (int i = n - 1; i >= 0; i--, m /= 10)
+      digits[i] = char('0' + m % 10);
+   int e = k + n - 1; // exponent of the first digit
+
+   if (e >= -5 && e < 0) {
+      *out++ = '0';
+      *out++ = '.';
+      for (int i = 0; i < -e - 1; i++)
+         *out++ = '0';
+      std::memcpy(out, digits, n);
+      return out + n;
+   }
+   if (e >= 0 && e < 9) {
+      if (e + 1 >= n) {
+         std::memcpy(out, digits, n);
+         out += n;
+         for (int i = n; i < e + 1; i++)
+            *out++ = '0';
+         return out;
+      }
+      std::memcpy(out, digits, e + 1);
+      out += e + 1;
+      *out++ = '.';
+      std::memcpy(out, digits + e + 1, n - e - 1);
+      return out + n - e - 1;
+   }
+   *out++ = digits[0];
+   if (n > 1) {
+      *out++ = '.';
+      std::memcpy(out, digits + 1, n - 1);
+      out += n - 1;
+   }
+   return out + std::sprintf(out, "e%c%02d", e < 0 ? '-' : '+', std::abs(e));
+}
+
+// Writes n / 10^decimals with exactly that many decimals
+char *format_fixed(char *out, int64_t n, int decimals) {
+   uint64_t u = n < 0 ? uint64_t(0) - uint64_t(n) : uint64_t(n);
+   if (n < 0)
+      *out++ = '-';
+   char digits[24];
+   int count = 0;
+   do {
+      digits[count++] = char('0' + u % 10);
+      u /= 10;
+   } while (u || count <= decimals);
+   while (count > 0) {
+      if (count-- == decimals)
+         *out++ = '.';
+      *out++ = digits[count];
+   }
+   return out;
+}
+
+// Writes the "x y z" header and the lines that line(i, out) formats for the points in mask, see write_xyz().
+// A line may take up to max_line characters.
+template <class Format>
+void write_xyz_lines(std::string path, size_t N, const std::vector<bool> &mask, size_t max_line, Format line) {
+   // windows fix
+   std::replace(path.begin(), path.end(), '\\', '/');
+   std::ofstream out(path.c_str(), std::ios::binary);
+   if (!out) {
+      std::cerr << "Invalid file path " << path << std::endl;
+      exit(1);
+   }
+
+   // many pointcloud xyz readers prefer a "header" line.
+   out << "x y z\n";
+
+   size_t blocks = (N + xyz_block - 1) / xyz_block;
+   int threads = 1;
+#ifdef WITH_OPENMP
+   threads = omp_get_max_threads();
+#endif
+   // a few blocks per thread at a time, so that the text of the whole cloud is never held at once
+   size_t group = 4 * size_t(threads);
+   std::vector<std::string> text(group);
+   for (size_t first = 0; first < blocks; first += group) {
+      int count = int(std::min(group, blocks - first));
+#pragma omp parallel for schedule(dynamic)
+      for (int b = 0; b < count; b++) {
+         size_t begin = (first + b) * xyz_block, end = std::min(begin + xyz_block, N);
+         std::string &t = text[b];
+         t.resize((end - begin) * max_line);
+         char *p = &t[0];
+         for (size_t i = begin; i < end; i++)
+            if (mask.empty() || mask[i])
+               p = line(i, p);
+         t.resize(p - &t[0]);
+      }
+      for (int b = 0; b < count; b++)
+         out.write(text[b].data(), text[b].size());
+   }
+
+   out.close();
+   if (!out) {
+      std::cerr << "Could not write " << path << std::endl;
+      exit(1);
+   }
+}
+
+void write_xyz(std::string path, const PointCloud &cloud, const std::vector<bool> &mask) {
+   write_xyz_lines(path, cloud.size(), mask, 3 * 17, [&](size_t i, char *p) {
+      const Point &pt = cloud[i];
+      p = format_float(p, pt.x);
+      *p++ = ' ';
+      p = format_float(p, pt.y);
+      *p++ = ' ';
+      p = format_float(p, pt.z);
+      *p++ = '\n';
+      return p;
+   });
+}
+
+void write_xyz(std::string path, const PointCloud &cloud, const quantized_cloud &quantized, const std::vector<bool> &mask) {
+   // The fewest decimals in which both the scale and the offset of an axis are whole numbers, then the text
+   // follows from the integers alone. Otherwise the world coordinates are printed with nine decimals.
+   int decimals[3];
+   bool exact[3];
+   int64_t factor[3], shift[3];
+   for (int k = 0; k < 3; k++) {
+      exact[k] = false;
+      for (decimals[k] = 0; !exact[k] && decimals[k] <= 9; decimals[k]++) {
+         double scale = quantized.scale[k] * exact_pow10[decimals[k]], offset = quantized.offset[k] * exact_pow10[decimals[k]];
+         exact[k] = scale >= 0.5 && scale < 2147483648.0 && std::fabs(scale - std::round(scale)) < 1e-6
+            && std::fabs(offset) < 1e18 && std::fabs(offset - std::round(offset)) < 1e-6;
+         factor[k] = std::llround(scale);
+         shift[k] = std::llround(offset);
+      }
+      decimals[k]--;
+   }
+
+   write_xyz_lines(path, cloud.size(), mask, 3 * 64, [&](size_t i, char *p) {
+      const Point &pt = cloud[i];
+      int64_t q[3] = { quantized.quantize(pt.x, 0), quantized.quantize(pt.y, 1), quantized.quantize(pt.z, 2) };
+      for (int k = 0; k < 3; k++) {
+         if (exact[k])
+            p = format_fixed(p, q[k] * factor[k] + shift[k], decimals[k]);
+         else
+            p += std::min(62, std::snprintf(p, 63, "%.*f", decimals[k], quantized.world(q[k], k)));
+         *p++ = k < 2 ? ' ' : '\n';
+      }
+      return p;
+   });
+}
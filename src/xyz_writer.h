@@ -0,0 +1,44 @@
+/*
+Copyright (c) 2016 Ravi Peters
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef MASBCPP_XYZ_WRITER_
+#define MASBCPP_XYZ_WRITER_
+
+#include <string>
+#include <vector>
+
+#include "quantized_cloud.h"
+#include "types.h"
+
+// Writes the shortest decimal representation of v that reads back as the same float, in the style of
+// printf's %g. Returns the end of the text, which takes at most 16 characters.
+char *format_float(char *out, float v);
+
+// Writes an "x y z" header and a line for every point for which mask is set, or for all points if mask
+// is empty. Blocks of points are formatted by all threads and written in order. Prints an error and
+// exits if the file can't be created.
+void write_xyz(std::string path, const PointCloud &cloud, const std::vector<bool> &mask = std::vector<bool>());
+// The same in world coordinates, for points that were read from a quantized format. They are written straight
+// from the recovered integers with as many decimals as the scale and offset of each axis need, so the text is exact.
+void write_xyz(std::string path, const PointCloud &cloud, const quantized_cloud &quantized, const std::vector<bool> &mask = std::vector<bool>());
+
+#endif